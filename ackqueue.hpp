@@ -0,0 +1,344 @@
+// At-least-once work queue on top of moodycamel::ConcurrentQueue.
+//
+// A received item is not gone: it stays in an in-flight slot of the
+// consumer that received it until that consumer acknowledges it. An item
+// that is not acknowledged within the visibility timeout -- because its
+// worker crashed, hung or simply forgot -- is put back into the queue by
+// ReapExpired() and delivered again, possibly to another consumer. Items can
+// therefore be processed more than once; handlers must be idempotent.
+//
+// Every consumer owns a fixed array of in-flight slots. A slot is a single
+// atomic state word (generation + phase) next to the item storage, so
+// receive, ack and reap are one CAS each and never take a lock. The
+// generation is part of the receipt: once a slot has been reaped (or
+// acked), stale receipts for it are rejected.
+//
+// Consumers hold at most `max_inflight` unacknowledged items; TryReceive
+// fails while all slots are taken, which bounds the redelivery work a
+// crashed worker can leave behind.
+
+#pragma once
+
+#include "conc.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace utils {
+
+    struct AckOptions {
+        /// How long a received item may stay unacknowledged before
+        /// ReapExpired() redelivers it
+        std::chrono::nanoseconds visibility_timeout = std::chrono::seconds(30);
+        /// In-flight slots per consumer
+        std::size_t max_inflight = 64;
+        /// Deliveries after which an unacknowledged item is moved to the
+        /// dead-letter queue instead of being redelivered; 0 for unlimited
+        std::uint32_t max_deliveries = 0;
+    };
+
+    template <typename T,
+              typename Traits = moodycamel::ConcurrentQueueDefaultTraits>
+    class AckQueue final {
+        struct Envelope {
+            T item;
+            std::uint32_t deliveries;
+        };
+
+        // Phases of an in-flight slot; the rest of the word is the
+        // generation, bumped every time the slot becomes free again
+        enum : std::uint64_t {
+            kFree = 0,
+            kInFlight = 1,
+            // Owned by whoever is acking or reaping it
+            kBusy = 2,
+            kPhaseMask = 3,
+            kGeneration = 4,
+        };
+
+        struct Slot {
+            std::atomic<std::uint64_t> state{kFree};
+            std::atomic<std::int64_t> deadline{0};
+            alignas(Envelope) unsigned char storage[sizeof(Envelope)];
+
+            auto Get() -> Envelope * {
+                return std::launder(reinterpret_cast<Envelope *>(storage));
+            }
+        };
+
+        struct ConsumerState {
+            explicit ConsumerState(std::size_t count)
+                : slots(new Slot[count]), slot_count(count) {}
+
+            std::unique_ptr<Slot[]> slots;
+            std::size_t slot_count;
+            std::size_t cursor = 0; // Owner only
+            std::atomic<bool> active{true};
+            ConsumerState *next = nullptr;
+        };
+
+    public:
+        /// @brief Identifies one delivery of an item; pass it to Ack/Nack.
+        struct Receipt {
+            void *slot = nullptr;
+            std::uint64_t generation = 0;
+            /// 1 for the first delivery, incremented on every redelivery
+            std::uint32_t delivery = 0;
+        };
+
+        /// @brief A consumer's in-flight slots and dequeue token. Use it
+        /// from one thread at a time. Destroying it redelivers whatever it
+        /// still holds right away.
+        class Consumer {
+        public:
+            Consumer(Consumer &&other) noexcept
+                : queue_(std::exchange(other.queue_, nullptr)),
+                  state_(std::exchange(other.state_, nullptr)),
+                  token_(std::move(other.token_)) {}
+
+            Consumer(const Consumer &) = delete;
+            auto operator=(const Consumer &) -> Consumer & = delete;
+            auto operator=(Consumer &&) -> Consumer & = delete;
+
+            ~Consumer() {
+                if (state_ != nullptr) {
+                    queue_->Release(*state_);
+                }
+            }
+
+        private:
+            friend class AckQueue;
+
+            Consumer(AckQueue *queue, ConsumerState *state)
+                : queue_(queue), state_(state), token_(queue->queue_) {}
+
+            AckQueue *queue_;
+            ConsumerState *state_;
+            moodycamel::ConsumerToken token_;
+        };
+
+        explicit AckQueue(AckOptions options = {},
+                          std::size_t capacity = 6 * Traits::BLOCK_SIZE)
+            : queue_(capacity), options_(options) {
+            if (options_.max_inflight == 0) {
+                options_.max_inflight = 1;
+            }
+        }
+
+        AckQueue(const AckQueue &) = delete;
+        auto operator=(const AckQueue &) -> AckQueue & = delete;
+
+        /// @brief All consumers must have been destroyed.
+        ~AckQueue() {
+            auto state = consumers_.load(std::memory_order_acquire);
+            while (state != nullptr) {
+                auto next = state->next;
+                for (std::size_t i = 0; i != state->slot_count; ++i) {
+                    auto &slot = state->slots[i];
+                    if ((slot.state.load(std::memory_order_relaxed) &
+                         kPhaseMask) != kFree) {
+                        slot.Get()->~Envelope();
+                    }
+                }
+                delete state;
+                state = next;
+            }
+        }
+
+        auto Enqueue(const T &item) -> bool {
+            return queue_.enqueue(Envelope{item, 0});
+        }
+
+        auto Enqueue(T &&item) -> bool {
+            return queue_.enqueue(Envelope{std::move(item), 0});
+        }
+
+        /// @brief Registers a consumer, reusing the slots of a destroyed one
+        /// if possible.
+        auto MakeConsumer() -> Consumer {
+            for (auto state = consumers_.load(std::memory_order_acquire);
+                 state != nullptr; state = state->next) {
+                bool expected = false;
+                if (!state->active.load(std::memory_order_relaxed) &&
+                    state->active.compare_exchange_strong(
+                        expected, true, std::memory_order_acquire,
+                        std::memory_order_relaxed)) {
+                    return Consumer(this, state);
+                }
+            }
+            auto state = new ConsumerState(options_.max_inflight);
+            auto head = consumers_.load(std::memory_order_relaxed);
+            do {
+                state->next = head;
+            } while (!consumers_.compare_exchange_weak(
+                head, state, std::memory_order_release,
+                std::memory_order_relaxed));
+            return Consumer(this, state);
+        }
+
+        /// @brief Dequeues an item into `item` (a copy; the queue keeps its
+        /// own until the receipt is acked). Fails if the queue appears empty
+        /// or all of the consumer's in-flight slots are taken.
+        auto TryReceive(Consumer &consumer, T &item, Receipt &receipt)
+            -> bool {
+            auto &state = *consumer.state_;
+            Slot *slot = nullptr;
+            std::uint64_t word = 0;
+            for (std::size_t n = 0; n != state.slot_count; ++n) {
+                auto &candidate = state.slots[state.cursor];
+                state.cursor = state.cursor + 1 == state.slot_count
+                                   ? 0
+                                   : state.cursor + 1;
+                // Acquire: a reaper may just have moved the old item out
+                word = candidate.state.load(std::memory_order_acquire);
+                if ((word & kPhaseMask) == kFree) {
+                    slot = &candidate;
+                    break;
+                }
+            }
+            if (slot == nullptr) {
+                return false;
+            }
+
+            // Only the owner moves a slot out of kFree, so the item can be
+            // moved straight from its block into the slot
+            Envelope *envelope = nullptr;
+            if (queue_.consume_bulk(consumer.token_, 1, [&](Envelope &taken) {
+                    envelope = new (slot->storage) Envelope(std::move(taken));
+                }) == 0) {
+                return false;
+            }
+            ++envelope->deliveries;
+            item = envelope->item;
+
+            slot->deadline.store(Now() + options_.visibility_timeout.count(),
+                                 std::memory_order_relaxed);
+            slot->state.store(word | kInFlight, std::memory_order_release);
+            receipt.slot = slot;
+            receipt.generation = word & ~kPhaseMask;
+            receipt.delivery = envelope->deliveries;
+            return true;
+        }
+
+        /// @brief Completes a delivery. Returns false if the receipt is
+        /// stale: the item already timed out and was (or is being)
+        /// redelivered.
+        auto Ack(const Receipt &receipt) -> bool {
+            auto slot = static_cast<Slot *>(receipt.slot);
+            if (slot == nullptr || !Claim(*slot, receipt.generation)) {
+                return false;
+            }
+            slot->Get()->~Envelope();
+            Free(*slot, receipt.generation);
+            return true;
+        }
+
+        /// @brief Gives an item back for immediate redelivery. Returns false
+        /// if the receipt is stale.
+        auto Nack(const Receipt &receipt) -> bool {
+            auto slot = static_cast<Slot *>(receipt.slot);
+            if (slot == nullptr || !Claim(*slot, receipt.generation)) {
+                return false;
+            }
+            Redeliver(*slot, receipt.generation);
+            return true;
+        }
+
+        /// @brief Redelivers every in-flight item whose visibility timeout
+        /// has passed; returns how many. Call it periodically from any
+        /// thread (concurrent calls are fine).
+        auto ReapExpired() -> std::size_t {
+            auto now = Now();
+            std::size_t reaped = 0;
+            for (auto state = consumers_.load(std::memory_order_acquire);
+                 state != nullptr; state = state->next) {
+                for (std::size_t i = 0; i != state->slot_count; ++i) {
+                    auto &slot = state->slots[i];
+                    auto word = slot.state.load(std::memory_order_acquire);
+                    if ((word & kPhaseMask) != kInFlight ||
+                        slot.deadline.load(std::memory_order_relaxed) > now) {
+                        continue;
+                    }
+                    auto generation = word & ~kPhaseMask;
+                    if (Claim(slot, generation)) {
+                        Redeliver(slot, generation);
+                        ++reaped;
+                    }
+                }
+            }
+            return reaped;
+        }
+
+        /// @brief Takes an item that exceeded max_deliveries.
+        auto TryDequeueDeadLetter(T &item) -> bool {
+            return dead_letters_.try_dequeue(item);
+        }
+
+        /// @brief Approximate number of items waiting for delivery, not
+        /// counting in-flight ones.
+        auto SizeApprox() const -> std::size_t { return queue_.size_approx(); }
+
+        /// @brief Items put back after a timeout, a Nack or a destroyed
+        /// consumer.
+        auto Redeliveries() const noexcept -> std::uint64_t {
+            return redeliveries_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static auto Now() -> std::int64_t {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        static auto Claim(Slot &slot, std::uint64_t generation) -> bool {
+            auto expected = generation | kInFlight;
+            return slot.state.compare_exchange_strong(
+                expected, generation | kBusy, std::memory_order_acquire,
+                std::memory_order_relaxed);
+        }
+
+        static void Free(Slot &slot, std::uint64_t generation) {
+            slot.state.store((generation + kGeneration) | kFree,
+                             std::memory_order_release);
+        }
+
+        // Called with the slot claimed
+        void Redeliver(Slot &slot, std::uint64_t generation) {
+            auto envelope = slot.Get();
+            if (options_.max_deliveries != 0 &&
+                envelope->deliveries >= options_.max_deliveries) {
+                dead_letters_.enqueue(std::move(envelope->item));
+            } else {
+                queue_.enqueue(std::move(*envelope));
+                redeliveries_.fetch_add(1, std::memory_order_relaxed);
+            }
+            envelope->~Envelope();
+            Free(slot, generation);
+        }
+
+        void Release(ConsumerState &state) {
+            for (std::size_t i = 0; i != state.slot_count; ++i) {
+                auto &slot = state.slots[i];
+                auto word = slot.state.load(std::memory_order_acquire);
+                if ((word & kPhaseMask) == kInFlight &&
+                    Claim(slot, word & ~kPhaseMask)) {
+                    Redeliver(slot, word & ~kPhaseMask);
+                }
+            }
+            state.active.store(false, std::memory_order_release);
+        }
+
+        moodycamel::ConcurrentQueue<Envelope, Traits> queue_;
+        moodycamel::ConcurrentQueue<T, Traits> dead_letters_{0};
+        AckOptions options_;
+        std::atomic<ConsumerState *> consumers_{nullptr};
+        std::atomic<std::uint64_t> redeliveries_{0};
+    };
+
+} // namespace utils
@@ -0,0 +1,758 @@
+// Asynchronous batched file writes for journals, logs and metrics dumps.
+//
+// Callers (typically executor workers) never touch the file descriptor: a
+// request is pushed into a lock-free queue and the call returns. On Linux the
+// requests are drained by one I/O thread that turns them into io_uring
+// submissions -- WRITE_FIXED for registered buffers, WRITEV otherwise, with an
+// optional IOSQE_IO_LINK'ed FSYNC -- and reaps completions in batches. When
+// io_uring is unavailable (old kernel, seccomp, non-Linux) a small thread pool
+// performs the same requests with pwritev()/fdatasync().
+//
+// Completions are not delivered on the I/O threads: they are queued and
+// handed to whoever calls PollCompletions(), i.e. the application's event
+// loop (see IDApplication::processEvents()).
+
+#pragma once
+
+#include "conc.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define UTILS_AIO_IO_URING 1
+#include <linux/io_uring.h>
+// <linux/fs.h>, pulled in above, defines BLOCK_SIZE as a macro, which
+// breaks every ConcurrentQueue traits class included after this header
+#undef BLOCK_SIZE
+#undef BLOCK_SIZE_BITS
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace utils {
+
+    enum class IoBackend { kIoUring, kThreadPool };
+
+    /// @brief Result of one write request (and its fsync, if requested).
+    struct IoCompletion {
+        std::uint64_t user_data;
+        /// Bytes written, or -errno of the first failed operation
+        std::int64_t result;
+    };
+
+    /// @brief Slot of the service's buffer pool. With the io_uring backend
+    /// the pool is registered with the kernel, so writes from it skip the
+    /// per-request page pinning.
+    struct IoBuffer {
+        static constexpr std::uint32_t kInvalid = 0xFFFFFFFFU;
+
+        std::uint32_t index = kInvalid;
+        char *data = nullptr;
+        std::size_t capacity = 0;
+
+        auto Valid() const noexcept -> bool { return index != kInvalid; }
+    };
+
+    struct IoServiceOptions {
+        /// Submission queue depth of the ring (rounded up by the kernel)
+        unsigned queue_depth = 256;
+        /// Number and size of the pooled, registered buffers
+        std::size_t buffer_count = 64;
+        std::size_t buffer_size = 64 * 1024;
+        /// Worker count of the fallback backend
+        unsigned fallback_threads = 2;
+        /// Skips io_uring even when it is available
+        bool force_fallback = false;
+    };
+
+    class IoService final {
+    public:
+        explicit IoService(IoServiceOptions options = {})
+            : options_(options) {
+            AllocateBuffers();
+#ifdef UTILS_AIO_IO_URING
+            if (!options_.force_fallback && ring_.Setup(options_, buffers_)) {
+                backend_ = IoBackend::kIoUring;
+                threads_.emplace_back([this] { RunRing(); });
+                return;
+            }
+#endif
+            backend_ = IoBackend::kThreadPool;
+            auto count = options_.fallback_threads == 0
+                             ? 1U
+                             : options_.fallback_threads;
+            for (unsigned i = 0; i != count; ++i) {
+                threads_.emplace_back([this] { RunPool(); });
+            }
+        }
+
+        IoService(const IoService &) = delete;
+        auto operator=(const IoService &) -> IoService & = delete;
+
+        /// @brief Completes every submitted request, then stops the threads.
+        /// Completions that were never polled are dropped.
+        ~IoService() {
+            stop_.store(true, std::memory_order_seq_cst);
+            Wake(true);
+            for (auto &thread : threads_) {
+                thread.join();
+            }
+#ifdef UTILS_AIO_IO_URING
+            ring_.Teardown();
+#endif
+            std::free(buffer_memory_);
+        }
+
+        auto Backend() const noexcept -> IoBackend { return backend_; }
+
+        /// @brief Takes a buffer from the pool; invalid if none is free.
+        /// The buffer goes back to the pool when the write using it
+        /// completes, or through ReleaseBuffer() if it is never submitted.
+        auto AcquireBuffer() -> IoBuffer {
+            std::uint32_t index;
+            if (!free_buffers_.try_dequeue(index)) {
+                return {};
+            }
+            return buffers_[index];
+        }
+
+        void ReleaseBuffer(const IoBuffer &buffer) {
+            if (buffer.Valid()) {
+                free_buffers_.enqueue(buffer.index);
+            }
+        }
+
+        /// @brief Writes `length` bytes of a pooled buffer at `offset`; with
+        /// `sync` the write is chained to an fdatasync of `fd`.
+        auto SubmitWrite(int fd, const IoBuffer &buffer, std::size_t length,
+                         std::uint64_t offset, bool sync,
+                         std::uint64_t user_data) -> bool {
+            if (!buffer.Valid() || length > buffer.capacity) {
+                return false;
+            }
+            Request request{};
+            request.fd = fd;
+            request.offset = offset;
+            request.buffer = buffer.index;
+            request.single = {buffer.data, length};
+            request.sync = sync;
+            request.user_data = user_data;
+            return Enqueue(request);
+        }
+
+        /// @brief Gathers `iovcnt` caller-owned segments at `offset`; the
+        /// iovec array and the memory it points to must stay valid until
+        /// the completion is polled.
+        auto SubmitWritev(int fd, const iovec *iov, int iovcnt,
+                          std::uint64_t offset, bool sync,
+                          std::uint64_t user_data) -> bool {
+            Request request{};
+            request.fd = fd;
+            request.offset = offset;
+            request.iov = iov;
+            request.iovcnt = iovcnt;
+            request.sync = sync;
+            request.user_data = user_data;
+            return Enqueue(request);
+        }
+
+        /// @brief Hands up to `max` completions to `fn`; returns how many.
+        template <typename Fn>
+        auto PollCompletions(Fn &&fn, std::size_t max = 64) -> std::size_t {
+            IoCompletion batch[64];
+            std::size_t total = 0;
+            while (total < max) {
+                auto want = max - total < 64 ? max - total : 64;
+                auto count = completions_.try_dequeue_bulk(batch, want);
+                for (std::size_t i = 0; i != count; ++i) {
+                    fn(batch[i]);
+                }
+                total += count;
+                if (count != want) {
+                    break;
+                }
+            }
+            return total;
+        }
+
+    private:
+        struct Request {
+            int fd;
+            std::uint64_t offset;
+            std::uint32_t buffer = IoBuffer::kInvalid;
+            iovec single;
+            const iovec *iov;
+            int iovcnt;
+            bool sync;
+            std::uint64_t user_data;
+        };
+
+        void AllocateBuffers() {
+            if (options_.buffer_count == 0 || options_.buffer_size == 0) {
+                return;
+            }
+            // Page alignment keeps the buffers usable with O_DIRECT files
+            constexpr std::size_t kPage = 4096;
+            auto size = (options_.buffer_size + kPage - 1) / kPage * kPage;
+            if (posix_memalign(&buffer_memory_, kPage,
+                               size * options_.buffer_count) != 0) {
+                buffer_memory_ = nullptr;
+                return;
+            }
+            buffers_.reserve(options_.buffer_count);
+            for (std::size_t i = 0; i != options_.buffer_count; ++i) {
+                IoBuffer buffer;
+                buffer.index = static_cast<std::uint32_t>(i);
+                buffer.data = static_cast<char *>(buffer_memory_) + i * size;
+                buffer.capacity = size;
+                buffers_.push_back(buffer);
+                free_buffers_.enqueue(buffer.index);
+            }
+        }
+
+        auto Enqueue(const Request &request) -> bool {
+            if (stop_.load(std::memory_order_relaxed) ||
+                !requests_.enqueue(request)) {
+                return false;
+            }
+            Wake(false);
+            return true;
+        }
+
+        void Complete(const Request &request, std::int64_t result) {
+            if (request.buffer != IoBuffer::kInvalid) {
+                free_buffers_.enqueue(request.buffer);
+            }
+            completions_.enqueue(IoCompletion{request.user_data, result});
+        }
+
+        void Wake(bool all) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (idle_.load(std::memory_order_relaxed) == 0) {
+                return;
+            }
+#ifdef UTILS_AIO_IO_URING
+            if (backend_ == IoBackend::kIoUring) {
+                ring_.Notify();
+                return;
+            }
+#endif
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (all) {
+                wakeup_.notify_all();
+            } else {
+                wakeup_.notify_one();
+            }
+        }
+
+        //////////////////////////////////
+        // Thread pool backend
+        //////////////////////////////////
+
+        void RunPool() {
+            Request request;
+            while (true) {
+                if (requests_.try_dequeue(request)) {
+                    Complete(request, Perform(request));
+                    continue;
+                }
+                if (stop_.load(std::memory_order_acquire)) {
+                    return;
+                }
+                idle_.fetch_add(1, std::memory_order_seq_cst);
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    if (requests_.size_approx() == 0 &&
+                        !stop_.load(std::memory_order_relaxed)) {
+                        // Timed, so a wakeup racing with the check above
+                        // costs latency at worst, never a hang
+                        wakeup_.wait_for(lock, std::chrono::milliseconds(10));
+                    }
+                }
+                idle_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        static auto Perform(const Request &request) -> std::int64_t {
+            // pwritev() may stop short, so work on a copy of the iovecs
+            auto src = request.iovcnt == 0 ? &request.single : request.iov;
+            auto count = request.iovcnt == 0 ? 1 : request.iovcnt;
+            iovec inline_iov[16];
+            std::vector<iovec> heap_iov;
+            auto iov = inline_iov;
+            if (count > 16) {
+                heap_iov.assign(src, src + count);
+                iov = heap_iov.data();
+            } else {
+                std::memcpy(inline_iov, src, sizeof(iovec) * count);
+            }
+
+            std::int64_t written = 0;
+            while (count != 0) {
+                auto n = ::pwritev(request.fd, iov, count,
+                                   static_cast<off_t>(request.offset +
+                                                      written));
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return -errno;
+                }
+                written += n;
+                // Skip what was written and retry the rest of a short write
+                while (count != 0 && static_cast<std::size_t>(n) >=
+                                         iov->iov_len) {
+                    n -= static_cast<ssize_t>(iov->iov_len);
+                    ++iov;
+                    --count;
+                }
+                if (count != 0) {
+                    iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+                    iov->iov_len -= static_cast<std::size_t>(n);
+                }
+            }
+            if (request.sync && ::fdatasync(request.fd) != 0) {
+                return -errno;
+            }
+            return written;
+        }
+
+#ifdef UTILS_AIO_IO_URING
+        //////////////////////////////////
+        // io_uring backend
+        //////////////////////////////////
+
+        // Raw ring; this header deliberately does not depend on liburing
+        class Ring {
+        public:
+            static constexpr std::uint64_t kWakeTag = ~std::uint64_t(0);
+            // Set in the user data of a request's linked fsync
+            static constexpr std::uint64_t kFsyncTag = std::uint64_t(1) << 32;
+
+            auto Setup(const IoServiceOptions &options,
+                       const std::vector<IoBuffer> &buffers) -> bool {
+                io_uring_params params{};
+                fd_ = static_cast<int>(::syscall(__NR_io_uring_setup,
+                                                 options.queue_depth,
+                                                 &params));
+                if (fd_ < 0) {
+                    return false;
+                }
+                sq_len_ = params.sq_off.array +
+                          params.sq_entries * sizeof(unsigned);
+                cq_len_ = params.cq_off.cqes +
+                          params.cq_entries * sizeof(io_uring_cqe);
+                bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                if (single) {
+                    sq_len_ = cq_len_ = sq_len_ > cq_len_ ? sq_len_ : cq_len_;
+                }
+                sq_ptr_ = ::mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd_,
+                                 IORING_OFF_SQ_RING);
+                cq_ptr_ = single ? sq_ptr_
+                                 : ::mmap(nullptr, cq_len_,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, fd_,
+                                          IORING_OFF_CQ_RING);
+                sqes_len_ = params.sq_entries * sizeof(io_uring_sqe);
+                sqes_ = static_cast<io_uring_sqe *>(
+                    ::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+                if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED ||
+                    sqes_ == MAP_FAILED) {
+                    Teardown();
+                    return false;
+                }
+
+                auto sq = static_cast<char *>(sq_ptr_);
+                sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+                sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+                sq_mask_ = *reinterpret_cast<unsigned *>(
+                    sq + params.sq_off.ring_mask);
+                sq_array_ =
+                    reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+                sq_entries_ = params.sq_entries;
+                auto cq = static_cast<char *>(cq_ptr_);
+                cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+                cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+                cq_mask_ = *reinterpret_cast<unsigned *>(
+                    cq + params.cq_off.ring_mask);
+                cqes_ =
+                    reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+                if (!buffers.empty()) {
+                    std::vector<iovec> iovecs;
+                    iovecs.reserve(buffers.size());
+                    for (auto &buffer : buffers) {
+                        iovecs.push_back({buffer.data, buffer.capacity});
+                    }
+                    // Without registration WRITE_FIXED is unusable, fall back
+                    // to WRITEV for pooled buffers too
+                    registered_ =
+                        ::syscall(__NR_io_uring_register, fd_,
+                                  IORING_REGISTER_BUFFERS, iovecs.data(),
+                                  static_cast<unsigned>(iovecs.size())) == 0;
+                }
+
+                event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+                if (event_fd_ < 0) {
+                    Teardown();
+                    return false;
+                }
+                return true;
+            }
+
+            void Teardown() {
+                if (sqes_ != nullptr && sqes_ != MAP_FAILED) {
+                    ::munmap(sqes_, sqes_len_);
+                }
+                if (cq_ptr_ != nullptr && cq_ptr_ != MAP_FAILED &&
+                    cq_ptr_ != sq_ptr_) {
+                    ::munmap(cq_ptr_, cq_len_);
+                }
+                if (sq_ptr_ != nullptr && sq_ptr_ != MAP_FAILED) {
+                    ::munmap(sq_ptr_, sq_len_);
+                }
+                sqes_ = nullptr;
+                sq_ptr_ = cq_ptr_ = nullptr;
+                if (event_fd_ >= 0) {
+                    ::close(event_fd_);
+                    event_fd_ = -1;
+                }
+                if (fd_ >= 0) {
+                    ::close(fd_);
+                    fd_ = -1;
+                }
+            }
+
+            auto Registered() const noexcept -> bool { return registered_; }
+
+            auto FreeSqes() const noexcept -> unsigned {
+                return sq_entries_ -
+                       (local_tail_ -
+                        __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE));
+            }
+
+            // Reserves the next SQE; the caller guarantees FreeSqes() != 0
+            auto NextSqe() -> io_uring_sqe * {
+                auto index = local_tail_ & sq_mask_;
+                auto sqe = &sqes_[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sq_array_[index] = index;
+                ++local_tail_;
+                ++pending_;
+                return sqe;
+            }
+
+            void ArmWakeup() {
+                auto sqe = NextSqe();
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = event_fd_;
+                sqe->poll_events = POLLIN;
+                sqe->user_data = kWakeTag;
+            }
+
+            void DrainWakeup() {
+                std::uint64_t value;
+                while (::read(event_fd_, &value, sizeof(value)) > 0) {
+                }
+            }
+
+            void Notify() {
+                std::uint64_t one = 1;
+                while (::write(event_fd_, &one, sizeof(one)) < 0 &&
+                       errno == EINTR) {
+                }
+            }
+
+            // Publishes pending SQEs and optionally waits for a completion
+            auto Enter(bool wait) -> int {
+                __atomic_store_n(sq_tail_, local_tail_, __ATOMIC_RELEASE);
+                auto submit = pending_;
+                auto result = static_cast<int>(::syscall(
+                    __NR_io_uring_enter, fd_, submit, wait ? 1U : 0U,
+                    wait ? IORING_ENTER_GETEVENTS : 0U, nullptr, 0));
+                if (result >= 0) {
+                    pending_ -= static_cast<unsigned>(result);
+                }
+                return result < 0 ? -errno : result;
+            }
+
+            template <typename Fn> auto Reap(Fn &&fn) -> unsigned {
+                auto head = *cq_head_;
+                auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+                unsigned count = 0;
+                for (; head != tail; ++head, ++count) {
+                    fn(cqes_[head & cq_mask_]);
+                }
+                __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+                return count;
+            }
+
+        private:
+            int fd_ = -1;
+            int event_fd_ = -1;
+            bool registered_ = false;
+
+            void *sq_ptr_ = nullptr;
+            void *cq_ptr_ = nullptr;
+            std::size_t sq_len_ = 0;
+            std::size_t cq_len_ = 0;
+            std::size_t sqes_len_ = 0;
+
+            unsigned *sq_head_ = nullptr;
+            unsigned *sq_tail_ = nullptr;
+            unsigned *sq_array_ = nullptr;
+            unsigned sq_mask_ = 0;
+            unsigned sq_entries_ = 0;
+            io_uring_sqe *sqes_ = nullptr;
+            unsigned local_tail_ = 0;
+            unsigned pending_ = 0;
+
+            unsigned *cq_head_ = nullptr;
+            unsigned *cq_tail_ = nullptr;
+            unsigned cq_mask_ = 0;
+            io_uring_cqe *cqes_ = nullptr;
+        };
+
+        // A submitted request, its progress and the number of its CQEs
+        // still outstanding
+        struct InFlight {
+            Request request;
+            std::uint64_t length;
+            std::uint64_t written;
+            std::int64_t write_error;
+            std::int64_t sync_result;
+            unsigned outstanding;
+            bool short_write;
+            // What is left of a short vectored write
+            std::vector<iovec> rest;
+        };
+
+        void RunRing() {
+            // Every request takes up to two CQEs and the wakeup poll one
+            // more; half the depth keeps the CQ ring from overflowing
+            auto depth = options_.queue_depth / 2 == 0
+                             ? 1U
+                             : options_.queue_depth / 2;
+            std::vector<InFlight> inflight(depth);
+            std::vector<std::uint32_t> free_slots;
+            free_slots.reserve(inflight.size());
+            for (auto i = static_cast<std::uint32_t>(inflight.size()); i != 0;) {
+                free_slots.push_back(--i);
+            }
+
+            // Slots whose write stopped short, to be continued
+            std::vector<std::uint32_t> retry;
+            retry.reserve(inflight.size());
+
+            bool armed = false;
+            Request batch[32];
+            while (true) {
+                if (!armed && ring_.FreeSqes() != 0) {
+                    ring_.ArmWakeup();
+                    armed = true;
+                }
+
+                bool queued = false;
+                while (!retry.empty() && ring_.FreeSqes() >= 2) {
+                    auto slot = retry.back();
+                    retry.pop_back();
+                    QueueWrite(slot, inflight[slot]);
+                    queued = true;
+                }
+
+                // Turn queued requests into SQEs, as many as the ring takes
+                while (!free_slots.empty() && ring_.FreeSqes() >= 2) {
+                    auto want = free_slots.size() < 32 ? free_slots.size() : 32;
+                    want = want < ring_.FreeSqes() / 2 ? want
+                                                       : ring_.FreeSqes() / 2;
+                    auto count = requests_.try_dequeue_bulk(batch, want);
+                    for (std::size_t i = 0; i != count; ++i) {
+                        auto slot = free_slots.back();
+                        free_slots.pop_back();
+                        PrepareWrite(batch[i], slot, inflight[slot]);
+                        queued = true;
+                    }
+                    if (count != want) {
+                        break;
+                    }
+                }
+
+                auto busy = free_slots.size() != inflight.size();
+                if (!queued && !busy && stop_.load(std::memory_order_acquire) &&
+                    requests_.size_approx() == 0) {
+                    return;
+                }
+
+                // Sleep in the kernel only if nothing new can be submitted;
+                // the armed eventfd poll wakes us up on the next request
+                bool wait = !queued;
+                if (wait) {
+                    idle_.fetch_add(1, std::memory_order_seq_cst);
+                    auto room = !free_slots.empty() && ring_.FreeSqes() >= 2;
+                    if ((room && requests_.size_approx() != 0) ||
+                        !retry.empty() ||
+                        (!busy && stop_.load(std::memory_order_relaxed))) {
+                        wait = false;
+                    }
+                }
+                int entered;
+                do {
+                    entered = ring_.Enter(wait && armed);
+                } while (entered == -EINTR);
+                if (!queued) {
+                    idle_.fetch_sub(1, std::memory_order_relaxed);
+                }
+
+                ring_.Reap([&](const io_uring_cqe &cqe) {
+                    if (cqe.user_data == Ring::kWakeTag) {
+                        ring_.DrainWakeup();
+                        armed = false;
+                        return;
+                    }
+                    auto slot = static_cast<std::uint32_t>(cqe.user_data);
+                    auto &op = inflight[slot];
+                    if ((cqe.user_data & Ring::kFsyncTag) != 0) {
+                        op.sync_result = cqe.res;
+                    } else if (cqe.res < 0) {
+                        op.write_error = cqe.res;
+                    } else {
+                        op.written += static_cast<std::uint64_t>(cqe.res);
+                        if (op.written < op.length) {
+                            // A write making no progress would never end
+                            op.short_write = cqe.res != 0;
+                            op.write_error = cqe.res != 0 ? 0 : -EIO;
+                        }
+                    }
+                    if (--op.outstanding != 0) {
+                        return;
+                    }
+                    // A short write cancels its linked fsync; like the
+                    // fallback, write the rest and only then sync
+                    if (op.write_error == 0 && op.short_write) {
+                        retry.push_back(slot);
+                        return;
+                    }
+                    std::int64_t result = static_cast<std::int64_t>(op.written);
+                    if (op.write_error != 0) {
+                        result = op.write_error;
+                    } else if (op.request.sync && op.sync_result < 0) {
+                        result = op.sync_result;
+                    }
+                    Complete(op.request, result);
+                    free_slots.push_back(slot);
+                });
+            }
+        }
+
+        void PrepareWrite(const Request &request, std::uint32_t slot,
+                          InFlight &op) {
+            op.request = request;
+            op.length = 0;
+            op.written = 0;
+            if (request.iovcnt == 0) {
+                op.length = request.single.iov_len;
+            } else {
+                for (int i = 0; i != request.iovcnt; ++i) {
+                    op.length += request.iov[i].iov_len;
+                }
+            }
+            QueueWrite(slot, op);
+        }
+
+        // Submits what is left of the request from op.written on, plus
+        // its fsync; takes two SQEs at most
+        void QueueWrite(std::uint32_t slot, InFlight &op) {
+            const auto &request = op.request;
+            op.write_error = 0;
+            op.sync_result = 0;
+            op.short_write = false;
+            op.outstanding = request.sync ? 2 : 1;
+
+            auto sqe = ring_.NextSqe();
+            sqe->fd = request.fd;
+            sqe->off = request.offset + op.written;
+            sqe->user_data = slot;
+            if (request.buffer != IoBuffer::kInvalid && ring_.Registered()) {
+                sqe->opcode = IORING_OP_WRITE_FIXED;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(
+                    static_cast<char *>(request.single.iov_base) + op.written);
+                sqe->len = static_cast<std::uint32_t>(request.single.iov_len -
+                                                      op.written);
+                sqe->buf_index = static_cast<std::uint16_t>(request.buffer);
+            } else {
+                // The iovecs must stay put until the kernel consumed them;
+                // the in-flight slot outlives the submission
+                const iovec *iov = request.iovcnt == 0 ? &op.request.single
+                                                       : request.iov;
+                auto count = request.iovcnt == 0 ? 1 : request.iovcnt;
+                if (op.written != 0) {
+                    auto skip = op.written;
+                    op.rest.clear();
+                    for (int i = 0; i != count; ++i) {
+                        if (skip >= iov[i].iov_len) {
+                            skip -= iov[i].iov_len;
+                            continue;
+                        }
+                        op.rest.push_back(
+                            {static_cast<char *>(iov[i].iov_base) + skip,
+                             iov[i].iov_len - skip});
+                        skip = 0;
+                    }
+                    iov = op.rest.data();
+                    count = static_cast<int>(op.rest.size());
+                }
+                sqe->opcode = IORING_OP_WRITEV;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(iov);
+                sqe->len = static_cast<std::uint32_t>(count);
+            }
+            if (request.sync) {
+                sqe->flags |= IOSQE_IO_LINK;
+                auto fsync = ring_.NextSqe();
+                fsync->opcode = IORING_OP_FSYNC;
+                fsync->fd = request.fd;
+                fsync->fsync_flags = IORING_FSYNC_DATASYNC;
+                fsync->user_data = slot | Ring::kFsyncTag;
+            }
+        }
+
+        Ring ring_{};
+#endif
+
+        IoServiceOptions options_;
+        IoBackend backend_ = IoBackend::kThreadPool;
+
+        void *buffer_memory_ = nullptr;
+        std::vector<IoBuffer> buffers_{};
+        moodycamel::ConcurrentQueue<std::uint32_t> free_buffers_{};
+
+        moodycamel::ConcurrentQueue<Request> requests_{};
+        moodycamel::ConcurrentQueue<IoCompletion> completions_{};
+
+        std::atomic<bool> stop_{false};
+        std::atomic<int> idle_{0};
+        std::mutex mutex_{};
+        std::condition_variable wakeup_{};
+        std::vector<std::thread> threads_{};
+    };
+
+} // namespace utils
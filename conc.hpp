@@ -263,6 +263,33 @@ namespace moodycamel {
 }
 #endif
 
+// Locality domain (NUMA node) of the calling thread, used to pair consumers
+// with producers running close to them. Platforms without a cheap way to ask
+// report a single domain, which makes locality-aware consumers behave like
+// plain ones.
+#if defined(__linux__) && !defined(MCDBGQ_USE_RELACY)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+namespace moodycamel {
+    namespace details {
+        static const std::uint32_t invalid_locality_domain = 0xFFFFFFFFU;
+    }
+
+    // Returns the locality domain the calling thread currently runs in. The
+    // scheduler may migrate the thread afterwards; pin threads (or set
+    // domains explicitly) where that matters.
+    inline std::uint32_t current_locality_domain() {
+#if defined(__linux__) && !defined(MCDBGQ_USE_RELACY) && defined(SYS_getcpu)
+        unsigned cpu = 0, node = 0;
+        if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+            return static_cast<std::uint32_t>(node);
+        }
+#endif
+        return 0;
+    }
+}
+
 // Constexpr if
 #ifndef MOODYCAMEL_CONSTEXPR_IF
 #if (defined(_MSC_VER) && defined(_HAS_CXX17) && _HAS_CXX17) ||                \
@@ -366,6 +393,24 @@ namespace moodycamel {
 #endif
 #endif
 
+// Thread exit notification lets the implicit producer of an exited thread
+// (and its blocks) be recycled by the next thread that needs one, instead of
+// lingering until the queue is destroyed. Without `thread_local` it is built
+// on a pthread key where thread IDs have a spare invalid value to mark
+// reusable hash slots (not on ARM, see thread_id_t above). Define
+// MOODYCAMEL_NO_PTHREAD_THREAD_EXIT_NOTIFIER to opt out.
+#ifndef MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
+#if defined(MOODYCAMEL_CPP11_THREAD_LOCAL_SUPPORTED)
+#define MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
+#elif defined(__linux__) && !defined(MCDBGQ_USE_RELACY) &&                     \
+    !defined(__arm__) && !defined(__aarch64__) &&                              \
+    !defined(MOODYCAMEL_NO_PTHREAD_THREAD_EXIT_NOTIFIER)
+#define MOODYCAMEL_PTHREAD_THREAD_EXIT_NOTIFIER
+#define MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
+#include <pthread.h>
+#endif
+#endif
+
 // VS2012 doesn't support deleted functions.
 // In this case, we declare the function normally but don't define it. A link
 // error will be generated if the function is called.
@@ -578,6 +623,11 @@ namespace moodycamel {
         static const std::uint32_t
             EXPLICIT_CONSUMER_CONSUMPTION_QUOTA_BEFORE_ROTATE = 256;
 
+        // Number of items a weight-1 producer may hand to a consumer per
+        // round of try_dequeue_fair (deficit round robin); a producer with
+        // weight w gets w times as many. Must be at least 1.
+        static const std::uint32_t FAIR_DEQUEUE_QUANTUM = 32;
+
         // The maximum number of elements (inclusive) that can be enqueued to a
         // sub-queue. Enqueue operations that would cause this limit to be
         // surpassed will fail. Note that this limit is enforced at the block
@@ -653,9 +703,14 @@ namespace moodycamel {
             ConcurrentQueueProducerTypelessBase* next;
             std::atomic<bool> inactive;
             ProducerToken* token;
+            // Share of the fair dequeue path, see try_dequeue_fair
+            std::atomic<std::uint32_t> weight;
+            // Domain the producer enqueues from, see current_locality_domain
+            std::atomic<std::uint32_t> locality;
 
             ConcurrentQueueProducerTypelessBase()
-                : next(nullptr), inactive(false), token(nullptr) {}
+                : next(nullptr), inactive(false), token(nullptr), weight(1),
+                  locality(current_locality_domain()) {}
         };
 
         template <bool use32> struct _hash_32_or_64 {
@@ -770,6 +825,28 @@ namespace moodycamel {
             return *it;
         }
 
+        // Output iterator that hands every element assigned through it to a
+        // callable instead of storing it, so that consume_bulk can reuse the
+        // dequeue_bulk paths: they move each element out of its block slot
+        // exactly once, right before destroying it
+        template <typename T, typename F> struct consume_iterator {
+            explicit consume_iterator(F& fn_) : fn(&fn_) {}
+
+            consume_iterator& operator*() MOODYCAMEL_NOEXCEPT { return *this; }
+            consume_iterator& operator++() MOODYCAMEL_NOEXCEPT { return *this; }
+            consume_iterator operator++(int) MOODYCAMEL_NOEXCEPT {
+                return *this;
+            }
+
+            consume_iterator& operator=(T&& element) noexcept(
+                noexcept(std::declval<F&>()(std::declval<T&>()))) {
+                (*fn)(element);
+                return *this;
+            }
+
+            F* fn;
+        };
+
 #if defined(__clang__) || !defined(__GNUC__) || __GNUC__ > 4 ||                \
     (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)
         template <typename T>
@@ -842,6 +919,171 @@ namespace moodycamel {
             ThreadExitListener* tail;
         };
 #endif
+#elif defined(MOODYCAMEL_PTHREAD_THREAD_EXIT_NOTIFIER)
+        struct ThreadExitListener {
+            typedef void (*callback_t)(void*);
+            callback_t callback;
+            void* userData;
+
+            ThreadExitListener*
+                next; // reserved for use by the ThreadExitNotifier
+            void* notifier; // ditto: list the listener is on, if any
+        };
+
+        // Same interface as the thread_local version, on top of a pthread key
+        // whose destructor runs when a thread exits. Each thread's listeners
+        // live in a heap node, and every listener knows its node, so a queue
+        // destroyed on another thread can still unsubscribe its producers.
+        // One process-wide mutex guards all the lists: subscribing and
+        // unsubscribing are rare, and a node can be freed by its exiting
+        // thread while another thread is unsubscribing from it.
+        class ThreadExitNotifier {
+        public:
+            static void subscribe(ThreadExitListener* listener) {
+                listener->notifier = nullptr;
+                auto node = instance();
+                if (node == nullptr) {
+                    return; // The producer just won't be recycled
+                }
+                Lock lock;
+                listener->next = node->tail;
+                listener->notifier = node;
+                node->tail = listener;
+            }
+
+            static void unsubscribe(ThreadExitListener* listener) {
+                Lock lock;
+                // If the listener's exiting thread is running its callback,
+                // wait for it to finish: the caller is about to free the
+                // listener (and probably the queue). The callback itself
+                // unsubscribes too, and must not wait on itself.
+                while (firing_elsewhere(listener)) {
+                    pthread_cond_wait(&global().fired, &global().mutex);
+                }
+                auto node = static_cast<Node*>(listener->notifier);
+                if (node == nullptr) {
+                    return;
+                }
+                ThreadExitListener** prev = &node->tail;
+                for (auto ptr = node->tail; ptr != nullptr; ptr = ptr->next) {
+                    if (ptr == listener) {
+                        *prev = ptr->next;
+                        break;
+                    }
+                    prev = &ptr->next;
+                }
+                listener->notifier = nullptr;
+            }
+
+        private:
+            struct Node {
+                ThreadExitListener* tail;
+            };
+
+            // A callback in progress, on the exiting thread's stack
+            struct Firing {
+                ThreadExitListener* listener;
+                pthread_t thread;
+                Firing* next;
+            };
+
+            struct Global {
+                pthread_mutex_t mutex;
+                pthread_cond_t fired;
+                Firing* firing;
+            };
+
+            struct Lock {
+                Lock() { pthread_mutex_lock(&global().mutex); }
+                ~Lock() { pthread_mutex_unlock(&global().mutex); }
+            };
+
+            struct Key {
+                Key() : valid(pthread_key_create(&key, &on_thread_exit) == 0) {}
+
+                pthread_key_t key;
+                bool valid;
+            };
+
+            static Key const& key() {
+                static const Key instance; // Never deleted: threads may
+                                           // outlive static destruction
+                return instance;
+            }
+
+            static Global& global() {
+                // Statically initialized and trivially destructible, so it
+                // is usable by threads exiting during static destruction
+                static Global instance = {PTHREAD_MUTEX_INITIALIZER,
+                                          PTHREAD_COND_INITIALIZER, nullptr};
+                return instance;
+            }
+
+            // Called with the global mutex held
+            static bool firing_elsewhere(ThreadExitListener* listener) {
+                for (auto it = global().firing; it != nullptr; it = it->next) {
+                    if (it->listener == listener) {
+                        return !pthread_equal(it->thread, pthread_self());
+                    }
+                }
+                return false;
+            }
+
+            static Node* instance() {
+                auto& k = key();
+                if (!k.valid) {
+                    return nullptr;
+                }
+                auto node = static_cast<Node*>(pthread_getspecific(k.key));
+                if (node == nullptr) {
+                    node = static_cast<Node*>(std::malloc(sizeof(Node)));
+                    if (node == nullptr) {
+                        return nullptr;
+                    }
+                    node->tail = nullptr;
+                    if (pthread_setspecific(k.key, node) != 0) {
+                        std::free(node);
+                        return nullptr;
+                    }
+                }
+                return node;
+            }
+
+            static void on_thread_exit(void* data) {
+                // This thread is about to exit, let everyone know! Listeners
+                // are taken off the list one at a time and fired without the
+                // lock held (their callbacks unsubscribe); concurrent
+                // unsubscribe calls for the one firing wait until it is done.
+                // Once its callback returns, a listener may already be freed
+                // and is not touched again.
+                auto node = static_cast<Node*>(data);
+                auto& g = global();
+                Firing firing = {nullptr, pthread_self(), nullptr};
+                pthread_mutex_lock(&g.mutex);
+                firing.next = g.firing;
+                g.firing = &firing;
+                while (node->tail != nullptr) {
+                    auto listener = node->tail;
+                    node->tail = listener->next;
+                    listener->notifier = nullptr;
+                    firing.listener = listener;
+                    pthread_mutex_unlock(&g.mutex);
+                    listener->callback(listener->userData);
+                    pthread_mutex_lock(&g.mutex);
+                    firing.listener = nullptr;
+                    pthread_cond_broadcast(&g.fired);
+                }
+                for (auto link = &g.firing; *link != nullptr;
+                     link = &(*link)->next) {
+                    if (*link == &firing) {
+                        *link = firing.next;
+                        break;
+                    }
+                }
+                pthread_mutex_unlock(&g.mutex);
+                std::free(node);
+            }
+        };
 #endif
 
         template <typename T> struct static_is_lock_free_num {
@@ -925,6 +1167,40 @@ namespace moodycamel {
         // but not which one; that's up to the user to track.
         inline bool valid() const { return producer != nullptr; }
 
+        // Sets this producer's weight for try_dequeue_fair: it is served
+        // `weight` times as many items per round as a weight-1 producer
+        // (implicit producers always have weight 1). Zero is treated as 1.
+        // Takes effect from the next round of each consumer. Thread-safe.
+        void set_weight(std::uint32_t weight) {
+            if (producer != nullptr) {
+                producer->weight.store(weight == 0 ? 1 : weight,
+                                       std::memory_order_relaxed);
+            }
+        }
+
+        std::uint32_t weight() const {
+            return producer != nullptr
+                       ? producer->weight.load(std::memory_order_relaxed)
+                       : 0;
+        }
+
+        // Overrides the locality domain recorded for this producer, which
+        // defaults to the domain of the thread that created the token. Use
+        // it when the producing thread is not the creating one, or to group
+        // producers by something other than NUMA node (e.g. L3 slice).
+        // Thread-safe.
+        void set_locality(std::uint32_t domain) {
+            if (producer != nullptr) {
+                producer->locality.store(domain, std::memory_order_relaxed);
+            }
+        }
+
+        std::uint32_t locality() const {
+            return producer != nullptr
+                       ? producer->locality.load(std::memory_order_relaxed)
+                       : details::invalid_locality_domain;
+        }
+
         ~ProducerToken() {
             if (producer != nullptr) {
                 producer->token = nullptr;
@@ -941,6 +1217,15 @@ namespace moodycamel {
         template <typename T, typename Traits> friend class ConcurrentQueue;
         friend class ConcurrentQueueTests;
 
+        // Binds a token to a producer that has no token yet
+        explicit ProducerToken(
+            details::ConcurrentQueueProducerTypelessBase* producer_)
+            : producer(producer_) {
+            if (producer != nullptr) {
+                producer->token = this;
+            }
+        }
+
     protected:
         details::ConcurrentQueueProducerTypelessBase* producer;
     };
@@ -952,12 +1237,25 @@ namespace moodycamel {
         template <typename T, typename Traits>
         explicit ConsumerToken(BlockingConcurrentQueue<T, Traits>& q);
 
+        // Locality-aware token: dequeues prefer producers whose locality
+        // domain is `locality` (e.g. current_locality_domain() of the
+        // consuming thread) and fall back to the others only when all local
+        // ones appear empty.
+        template <typename T, typename Traits>
+        ConsumerToken(ConcurrentQueue<T, Traits>& q, std::uint32_t locality);
+
+        template <typename T, typename Traits>
+        ConsumerToken(BlockingConcurrentQueue<T, Traits>& q,
+                      std::uint32_t locality);
+
         ConsumerToken(ConsumerToken&& other) MOODYCAMEL_NOEXCEPT
             : initialOffset(other.initialOffset),
               lastKnownGlobalOffset(other.lastKnownGlobalOffset),
               itemsConsumedFromCurrent(other.itemsConsumedFromCurrent),
               currentProducer(other.currentProducer),
-              desiredProducer(other.desiredProducer) {}
+              desiredProducer(other.desiredProducer),
+              fairProducer(other.fairProducer),
+              fairDeficit(other.fairDeficit), locality(other.locality) {}
 
         inline ConsumerToken&
             operator=(ConsumerToken&& other) MOODYCAMEL_NOEXCEPT {
@@ -971,6 +1269,9 @@ namespace moodycamel {
             std::swap(itemsConsumedFromCurrent, other.itemsConsumedFromCurrent);
             std::swap(currentProducer, other.currentProducer);
             std::swap(desiredProducer, other.desiredProducer);
+            std::swap(fairProducer, other.fairProducer);
+            std::swap(fairDeficit, other.fairDeficit);
+            std::swap(locality, other.locality);
         }
 
         // Disable copying and assignment
@@ -988,6 +1289,14 @@ namespace moodycamel {
         std::uint32_t itemsConsumedFromCurrent;
         details::ConcurrentQueueProducerTypelessBase* currentProducer;
         details::ConcurrentQueueProducerTypelessBase* desiredProducer;
+
+        // Deficit round robin state of try_dequeue_fair: the producer being
+        // served and how many more items it may hand over this round
+        details::ConcurrentQueueProducerTypelessBase* fairProducer;
+        std::uint32_t fairDeficit;
+
+        // Preferred producer domain, invalid_locality_domain for none
+        std::uint32_t locality;
     };
 
     // Need to forward-declare this swap because it's in a namespace.
@@ -1022,6 +1331,8 @@ namespace moodycamel {
             EXPLICIT_CONSUMER_CONSUMPTION_QUOTA_BEFORE_ROTATE =
                 static_cast<std::uint32_t>(
                     Traits::EXPLICIT_CONSUMER_CONSUMPTION_QUOTA_BEFORE_ROTATE);
+        static const std::uint32_t FAIR_DEQUEUE_QUANTUM =
+            static_cast<std::uint32_t>(Traits::FAIR_DEQUEUE_QUANTUM);
 #ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4307) // + integral constant overflow (that's what the
@@ -1498,6 +1809,9 @@ namespace moodycamel {
             // but you've run out of items to consume, move over from your
             // current position until you find an producer with something in it
 
+            if (token.locality != details::invalid_locality_domain) {
+                return try_dequeue_local_first(token, item);
+            }
             if (token.desiredProducer == nullptr ||
                 token.lastKnownGlobalOffset !=
                     globalExplicitConsumerOffset.load(
@@ -1558,6 +1872,29 @@ namespace moodycamel {
             return count;
         }
 
+        // Like try_dequeue_bulk, but calls `fn(T&)` on each element while it
+        // is still in its block slot, and destroys it right after; nothing
+        // is moved into an intermediate buffer. `fn` may move from the
+        // element. Returns the number of elements consumed. If `fn` throws,
+        // the rest of the elements claimed by the call are destroyed without
+        // being visited and the exception propagates. Never allocates.
+        // Thread-safe.
+        template <typename F> size_t consume_bulk(size_t max, F&& fn) {
+            return try_dequeue_bulk(
+                details::consume_iterator<
+                    T, typename std::remove_reference<F>::type>(fn),
+                max);
+        }
+
+        template <typename F>
+        size_t consume_bulk(consumer_token_t& token, size_t max, F&& fn) {
+            return try_dequeue_bulk(
+                token,
+                details::consume_iterator<
+                    T, typename std::remove_reference<F>::type>(fn),
+                max);
+        }
+
         // Attempts to dequeue several elements from the queue using an explicit
         // consumer token. Returns the number of items actually dequeued.
         // Returns 0 if all producer streams appeared empty at the time they
@@ -1566,6 +1903,9 @@ namespace moodycamel {
         template <typename It>
         size_t try_dequeue_bulk(consumer_token_t& token, It itemFirst,
                                 size_t max) {
+            if (token.locality != details::invalid_locality_domain) {
+                return try_dequeue_bulk_local_first(token, itemFirst, max);
+            }
             if (token.desiredProducer == nullptr ||
                 token.lastKnownGlobalOffset !=
                     globalExplicitConsumerOffset.load(
@@ -1615,6 +1955,102 @@ namespace moodycamel {
             return count;
         }
 
+        // Attempts to dequeue an item while sharing consumers fairly between
+        // producers: deficit round robin, where every producer is visited in
+        // turn and may hand over up to FAIR_DEQUEUE_QUANTUM * weight items
+        // before the consumer moves on (an empty producer forfeits the rest
+        // of its turn). Bandwidth is thus split in proportion to the weights
+        // set through ProducerToken::set_weight, and a producer waits at most
+        // one round of its peers' quanta. The round state lives in the token,
+        // so each consumer runs its own round. Returns false if all producer
+        // streams appeared empty at the time they were checked. Never
+        // allocates. Thread-safe.
+        template <typename U>
+        bool try_dequeue_fair(consumer_token_t& token, U& item) {
+            auto tail = producerListTail.load(std::memory_order_acquire);
+            if (tail == nullptr) {
+                return false;
+            }
+            auto ptr = static_cast<ProducerBase*>(token.fairProducer);
+            if (ptr == nullptr) {
+                ptr = tail;
+                token.fairDeficit = fair_quantum(ptr);
+            }
+
+            // One full lap, then one more attempt at the starting producer
+            // with a fresh quantum
+            auto start = ptr;
+            bool lapped = false;
+            while (true) {
+                if (token.fairDeficit != 0 && ptr->dequeue(item)) {
+                    --token.fairDeficit;
+                    token.fairProducer = ptr;
+                    return true;
+                }
+                if (lapped) {
+                    break;
+                }
+                ptr = ptr->next_prod();
+                if (ptr == nullptr) {
+                    ptr = tail;
+                }
+                token.fairDeficit = fair_quantum(ptr);
+                lapped = ptr == start;
+            }
+            token.fairProducer = ptr;
+            return false;
+        }
+
+        // Bulk version of try_dequeue_fair; one call may span several turns.
+        // Returns the number of items actually dequeued. Never allocates.
+        // Thread-safe.
+        template <typename It>
+        size_t try_dequeue_bulk_fair(consumer_token_t& token, It itemFirst,
+                                     size_t max) {
+            auto tail = producerListTail.load(std::memory_order_acquire);
+            if (tail == nullptr || max == 0) {
+                return 0;
+            }
+            auto ptr = static_cast<ProducerBase*>(token.fairProducer);
+            if (ptr == nullptr) {
+                ptr = tail;
+                token.fairDeficit = fair_quantum(ptr);
+            }
+
+            // Stop after a full lap without progress
+            size_t count = 0;
+            auto mark = ptr;
+            bool lapped = false;
+            while (true) {
+                if (token.fairDeficit != 0) {
+                    auto want = max - count < token.fairDeficit
+                                    ? max - count
+                                    : static_cast<size_t>(token.fairDeficit);
+                    auto dequeued = ptr->dequeue_bulk(itemFirst, want);
+                    token.fairDeficit -= static_cast<std::uint32_t>(dequeued);
+                    count += dequeued;
+                    if (count == max) {
+                        break;
+                    }
+                    if (dequeued != 0) {
+                        mark = ptr;
+                        lapped = false;
+                    }
+                }
+                if (lapped) {
+                    break;
+                }
+                ptr = ptr->next_prod();
+                if (ptr == nullptr) {
+                    ptr = tail;
+                }
+                token.fairDeficit = fair_quantum(ptr);
+                lapped = ptr == mark;
+            }
+            token.fairProducer = ptr;
+            return count;
+        }
+
         // Attempts to dequeue from a specific producer's inner queue.
         // If you happen to know which producer you want to dequeue from, this
         // is significantly faster than using the general-case try_dequeue
@@ -1643,6 +2079,57 @@ namespace moodycamel {
                 ->dequeue_bulk(itemFirst, max);
         }
 
+        // Grows the block index of the token's producer up front so that it
+        // can hold `expectedBacklog` elements without reallocating (and
+        // without leaving superseded indexes behind) while enqueueing.
+        // Returns false if the allocation failed. Must be called by the
+        // thread that enqueues with `token`; not thread-safe otherwise.
+        bool reserve_block_index(producer_token_t const& token,
+                                 size_t expectedBacklog) {
+            if (token.producer == nullptr) {
+                return false;
+            }
+            return static_cast<ExplicitProducer*>(token.producer)
+                ->reserve_block_index(expectedBacklog);
+        }
+
+        // Moves everything enqueued through `sourceToken`, a producer of
+        // `source` (another queue of the same type), into a new producer of
+        // this queue and returns its token. Items keep their order and are
+        // dequeued from this queue from then on; the returned token can keep
+        // enqueueing behind them. Costs O(blocks): full blocks that were
+        // allocated on the heap change owner by pointer, and only blocks of
+        // the source's initial pool (which cannot outlive `source`) and a
+        // partially filled tail block (which `sourceToken` keeps enqueueing
+        // into) are copied element-wise. If memory could not be allocated,
+        // nothing is moved and the returned token is invalid.
+        // The source producer must be quiescent: neither its owner nor any
+        // consumer of `source` may use it during the call. Consumers of this
+        // queue may run concurrently. `sourceToken` stays valid and empty.
+        ProducerToken splice(ConcurrentQueue& source,
+                             producer_token_t const& sourceToken) {
+            static_assert(std::is_nothrow_move_constructible<T>::value,
+                          "splice moves partially filled blocks element-wise "
+                          "and cannot roll back a throwing move");
+            if (&source == this || sourceToken.producer == nullptr) {
+                return ProducerToken(nullptr);
+            }
+            auto from = static_cast<ExplicitProducer*>(sourceToken.producer);
+            auto to = create<ExplicitProducer>(this);
+            if (to == nullptr) {
+                return ProducerToken(nullptr);
+            }
+            if (!from->splice_into(to)) {
+                destroy(to);
+                return ProducerToken(nullptr);
+            }
+            to->weight.store(from->weight.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+            to->locality.store(from->locality.load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+            return ProducerToken(add_producer(to));
+        }
+
         // Returns an estimate of the total number of elements currently in the
         // queue. This estimate is only accurate if the queue has completely
         // stabilized before it is called (i.e. all enqueue and dequeue
@@ -1723,6 +2210,129 @@ namespace moodycamel {
                              template enqueue_bulk<canAlloc>(itemFirst, count);
         }
 
+        // Dequeue path of locality-aware consumer tokens. A consumer sticks
+        // to the local producer it last took from for up to
+        // EXPLICIT_CONSUMER_CONSUMPTION_QUOTA_BEFORE_ROTATE items, then moves
+        // on to the next local one; remote producers are only scanned once
+        // every local one came up empty, and are never stuck to, so local
+        // data is picked up again as soon as it shows up.
+        template <typename U>
+        bool try_dequeue_local_first(consumer_token_t& token, U& item) {
+            auto tail = producerListTail.load(std::memory_order_acquire);
+            if (tail == nullptr) {
+                return false;
+            }
+            auto current = static_cast<ProducerBase*>(token.currentProducer);
+            if (current != nullptr &&
+                token.itemsConsumedFromCurrent <
+                    EXPLICIT_CONSUMER_CONSUMPTION_QUOTA_BEFORE_ROTATE &&
+                current->dequeue(item)) {
+                ++token.itemsConsumedFromCurrent;
+                return true;
+            }
+
+            auto start = current != nullptr ? current->next_prod()
+                                            : local_scan_start(token, tail);
+            if (start == nullptr) {
+                start = tail;
+            }
+            for (int remote = 0; remote != 2; ++remote) {
+                auto ptr = start;
+                do {
+                    bool local = ptr->locality.load(std::memory_order_relaxed) ==
+                                 token.locality;
+                    if (local != (remote != 0) && ptr->dequeue(item)) {
+                        token.currentProducer = local ? ptr : nullptr;
+                        token.itemsConsumedFromCurrent = 1;
+                        return true;
+                    }
+                    ptr = ptr->next_prod();
+                    if (ptr == nullptr) {
+                        ptr = tail;
+                    }
+                } while (ptr != start);
+            }
+            return false;
+        }
+
+        template <typename It>
+        size_t try_dequeue_bulk_local_first(consumer_token_t& token,
+                                            It itemFirst, size_t max) {
+            auto tail = producerListTail.load(std::memory_order_acquire);
+            if (tail == nullptr || max == 0) {
+                return 0;
+            }
+            size_t count = 0;
+            auto current = static_cast<ProducerBase*>(token.currentProducer);
+            if (current != nullptr &&
+                token.itemsConsumedFromCurrent <
+                    EXPLICIT_CONSUMER_CONSUMPTION_QUOTA_BEFORE_ROTATE) {
+                count = current->dequeue_bulk(itemFirst, max);
+                token.itemsConsumedFromCurrent +=
+                    static_cast<std::uint32_t>(count);
+                if (count == max) {
+                    return count;
+                }
+            }
+
+            auto start = current != nullptr ? current->next_prod()
+                                            : local_scan_start(token, tail);
+            if (start == nullptr) {
+                start = tail;
+            }
+            for (int remote = 0; remote != 2; ++remote) {
+                auto ptr = start;
+                do {
+                    bool local = ptr->locality.load(std::memory_order_relaxed) ==
+                                 token.locality;
+                    if (local != (remote != 0)) {
+                        auto dequeued = ptr->dequeue_bulk(itemFirst, max - count);
+                        if (dequeued != 0) {
+                            count += dequeued;
+                            token.currentProducer = local ? ptr : nullptr;
+                            token.itemsConsumedFromCurrent =
+                                static_cast<std::uint32_t>(dequeued);
+                            if (count == max) {
+                                return count;
+                            }
+                        }
+                    }
+                    ptr = ptr->next_prod();
+                    if (ptr == nullptr) {
+                        ptr = tail;
+                    }
+                } while (ptr != start);
+                // Local producers ran dry before `max`; top up from remote
+                // ones only if nothing local was found at all
+                if (count != 0) {
+                    break;
+                }
+            }
+            return count;
+        }
+
+        // Where a locality-aware consumer that is not attached to a producer
+        // starts scanning: spread by consumer id like the rotation path, so
+        // that consumers of one domain do not all pile onto the same producer
+        template <typename Producer>
+        Producer* local_scan_start(consumer_token_t& token, Producer* tail) {
+            if (token.desiredProducer == nullptr) {
+                auto prodCount = producerCount.load(std::memory_order_relaxed);
+                auto ptr = tail;
+                for (std::uint32_t i = prodCount == 0
+                                           ? 0
+                                           : token.initialOffset % prodCount;
+                     i != 0; --i) {
+                    ptr = ptr->next_prod();
+                    if (ptr == nullptr) {
+                        ptr = tail;
+                    }
+                }
+                token.desiredProducer = ptr;
+            }
+            return static_cast<Producer*>(token.desiredProducer);
+        }
+
         inline bool
             update_current_producer_after_rotation(consumer_token_t& token) {
             // Ah, there's been a rotation, figure out where we should be!
@@ -2191,7 +2801,8 @@ namespace moodycamel {
                   pr_blockIndexSlotsUsed(0),
                   pr_blockIndexSize(EXPLICIT_INITIAL_INDEX_SIZE >> 1),
                   pr_blockIndexFront(0), pr_blockIndexEntries(nullptr),
-                  pr_blockIndexRaw(nullptr) {
+                  pr_blockIndexRaw(nullptr), pr_retiredIndexTail(0),
+                  pr_reclaimCursor(0), pr_hasRetiredIndices(false) {
                 size_t poolBasedIndexSize =
                     details::ceil_to_pow_2(parent_->initialBlockPoolSize) >> 1;
                 if (poolBasedIndexSize > pr_blockIndexSize) {
@@ -2300,6 +2911,9 @@ namespace moodycamel {
                 if ((currentTailIndex & static_cast<index_t>(BLOCK_SIZE - 1)) ==
                     0) {
                     // We reached the end of a block, start a new one
+                    if (pr_hasRetiredIndices) {
+                        try_reclaim_block_indices();
+                    }
                     auto startBlock = this->tailBlock;
                     auto originalBlockIndexSlotsUsed = pr_blockIndexSlotsUsed;
                     if (this->tailBlock != nullptr &&
@@ -2615,6 +3229,10 @@ namespace moodycamel {
                     (startTailIndex - 1) &
                     ~static_cast<index_t>(BLOCK_SIZE - 1);
                 if (blockBaseDiff > 0) {
+                    if (pr_hasRetiredIndices) {
+                        try_reclaim_block_indices();
+                    }
+
                     // Allocate as many blocks as possible from ahead
                     while (blockBaseDiff > 0 && this->tailBlock != nullptr &&
                            this->tailBlock->next != firstAllocatedBlock &&
@@ -2931,8 +3549,13 @@ namespace moodycamel {
                                 typename std::make_signed<index_t>::type>(
                                 firstBlockBaseIndex - headBase) /
                             BLOCK_SIZE);
+                        // Cache the mask: once the last set_many_empty below
+                        // is done, the producer may free a superseded index
+                        // (see try_reclaim_block_indices), so the header must
+                        // not be touched after it
+                        auto localBlockIndexMask = localBlockIndex->size - 1;
                         auto indexIndex = (localBlockIndexHead + offset) &
-                                          (localBlockIndex->size - 1);
+                                          localBlockIndexMask;
 
                         // Iterate the blocks and dequeue
                         auto index = firstIndex;
@@ -2992,9 +3615,8 @@ namespace moodycamel {
                                                 static_cast<size_t>(
                                                     endIndex -
                                                     firstIndexInBlock));
-                                        indexIndex =
-                                            (indexIndex + 1) &
-                                            (localBlockIndex->size - 1);
+                                        indexIndex = (indexIndex + 1) &
+                                                     localBlockIndexMask;
 
                                         firstIndexInBlock = index;
                                         endIndex =
@@ -3023,7 +3645,7 @@ namespace moodycamel {
                                     static_cast<size_t>(endIndex -
                                                         firstIndexInBlock));
                             indexIndex =
-                                (indexIndex + 1) & (localBlockIndex->size - 1);
+                                (indexIndex + 1) & localBlockIndexMask;
                         } while (index != firstIndex + actualCount);
 
                         return actualCount;
@@ -3052,17 +3674,180 @@ namespace moodycamel {
                 void* prev;
             };
 
-            bool new_block_index(size_t numberOfFilledSlotsToExpose) {
+        public:
+            bool reserve_block_index(size_t expectedBacklog) {
+                // A backlog that is not block-aligned can touch one more
+                // block at each end
+                auto blocks = (expectedBacklog + BLOCK_SIZE - 1) / BLOCK_SIZE + 2;
+                if (pr_blockIndexRaw != nullptr && blocks <= pr_blockIndexSize) {
+                    return true;
+                }
+                return new_block_index(pr_blockIndexSlotsUsed, blocks);
+            }
+
+            // Hands the backlog over to `target`, a fresh producer of another
+            // queue that is not published yet, keeping its index values (so
+            // that moved blocks line up without shifting any element). Full
+            // heap blocks are relinked; initial-pool blocks and a partial
+            // tail block are copied into blocks of the target's queue. Blocks
+            // that held no backlog go back to this queue's free list; a
+            // partial tail block stays, as the producer continues in it.
+            // Everything that can fail is done before the backlog is touched.
+            // Requires the producer to be quiescent (see ConcurrentQueue::
+            // splice).
+            bool splice_into(ExplicitProducer* target) {
+                auto head = this->headIndex.load(std::memory_order_relaxed);
+                auto tail = this->tailIndex.load(std::memory_order_relaxed);
+                if (!details::circular_less_than<index_t>(head, tail)) {
+                    return true;
+                }
+
+                auto mask = pr_blockIndexSize - 1;
+                auto headBase = head & ~static_cast<index_t>(BLOCK_SIZE - 1);
+                auto blockCount = static_cast<size_t>(
+                    (tail - 1 - headBase) / static_cast<index_t>(BLOCK_SIZE) +
+                    1);
+                auto oldestSlot =
+                    (pr_blockIndexFront - pr_blockIndexSlotsUsed) & mask;
+                auto firstSlot =
+                    (oldestSlot +
+                     static_cast<size_t>(
+                         (headBase - pr_blockIndexEntries[oldestSlot].base) /
+                         BLOCK_SIZE)) &
+                    mask;
+                bool keepTail =
+                    (tail & static_cast<index_t>(BLOCK_SIZE - 1)) != 0;
+
+                if (!target->reserve_block_index(blockCount * BLOCK_SIZE)) {
+                    return false;
+                }
+                if (target->pr_hasRetiredIndices) {
+                    // Nobody can have seen the target's initial index yet
+                    target->try_reclaim_block_indices();
+                }
+                Block* copies = nullptr;
+                for (size_t k = 0; k != blockCount; ++k) {
+                    auto block = pr_blockIndexEntries[(firstSlot + k) & mask].block;
+                    if (block->dynamicallyAllocated &&
+                        !(keepTail && k == blockCount - 1)) {
+                        continue;
+                    }
+                    auto copy = target->parent->ConcurrentQueue::
+                        template requisition_block<CanAlloc>();
+                    if (copy == nullptr) {
+                        target->parent->add_blocks_to_free_list(copies);
+                        return false;
+                    }
+                    copy->next = copies;
+                    copies = copy;
+                }
+
+                // Blocks between the tail and the head block hold no backlog
+                auto firstBlock = pr_blockIndexEntries[firstSlot].block;
+                for (auto block = this->tailBlock->next; block != firstBlock;) {
+                    auto next = block->next;
+                    this->parent->add_block_to_free_list(block);
+                    block = next;
+                }
+
+                Block* prev = nullptr;
+                Block* first = nullptr;
+                for (size_t k = 0; k != blockCount; ++k) {
+                    auto& entry = pr_blockIndexEntries[(firstSlot + k) & mask];
+                    auto block = entry.block;
+                    bool kept = keepTail && k == blockCount - 1;
+                    if (!block->dynamicallyAllocated || kept) {
+                        auto copy = copies;
+                        copies = copies->next;
+                        copy->ConcurrentQueue::Block::template reset_empty<
+                            explicit_context>();
+                        auto lo = k == 0 ? head : entry.base;
+                        auto hi = kept ? tail
+                                       : entry.base +
+                                             static_cast<index_t>(BLOCK_SIZE);
+                        if (lo != entry.base) {
+                            copy->ConcurrentQueue::Block::template set_many_empty<
+                                explicit_context>(
+                                entry.base, static_cast<size_t>(lo - entry.base));
+                        }
+                        for (auto i = lo; i != hi; ++i) {
+                            new ((*copy)[i]) T(std::move(*(*block)[i]));
+                            (*block)[i]->~T();
+                        }
+                        if (kept) {
+                            block->ConcurrentQueue::Block::template set_many_empty<
+                                explicit_context>(lo,
+                                                  static_cast<size_t>(hi - lo));
+                        } else {
+                            this->parent->add_block_to_free_list(block);
+                        }
+                        block = copy;
+                    }
+#ifdef MCDBGQ_TRACKMEM
+                    block->owner = target;
+#endif
+                    if (prev == nullptr) {
+                        first = block;
+                    } else {
+                        prev->next = block;
+                    }
+                    prev = block;
+                    target->pr_blockIndexEntries[k].base = entry.base;
+                    target->pr_blockIndexEntries[k].block = block;
+                }
+                prev->next = first;
+
+                target->tailBlock = prev;
+                target->pr_blockIndexSlotsUsed = blockCount;
+                target->pr_blockIndexFront =
+                    blockCount & (target->pr_blockIndexSize - 1);
+                target->blockIndex.load(std::memory_order_relaxed)
+                    ->front.store(blockCount - 1, std::memory_order_relaxed);
+                target->headIndex.store(head, std::memory_order_relaxed);
+                target->dequeueOptimisticCount.store(head,
+                                                     std::memory_order_relaxed);
+                target->dequeueOvercommit.store(0, std::memory_order_relaxed);
+                target->tailIndex.store(tail, std::memory_order_relaxed);
+
+                if (keepTail) {
+                    this->tailBlock->next = this->tailBlock;
+                    pr_blockIndexEntries[0].base =
+                        tail & ~static_cast<index_t>(BLOCK_SIZE - 1);
+                    pr_blockIndexEntries[0].block = this->tailBlock;
+                    pr_blockIndexSlotsUsed = 1;
+                    pr_blockIndexFront = 1;
+                    blockIndex.load(std::memory_order_relaxed)
+                        ->front.store(0, std::memory_order_relaxed);
+                } else {
+                    this->tailBlock = nullptr;
+                    pr_blockIndexSlotsUsed = 0;
+                    pr_blockIndexFront = 0;
+                }
+                this->headIndex.store(tail, std::memory_order_relaxed);
+                this->dequeueOptimisticCount.store(tail,
+                                                   std::memory_order_relaxed);
+                this->dequeueOvercommit.store(0, std::memory_order_relaxed);
+                return true;
+            }
+
+        private:
+            bool new_block_index(size_t numberOfFilledSlotsToExpose,
+                                 size_t minIndexSize = 0) {
                 auto prevBlockSizeMask = pr_blockIndexSize - 1;
+                auto prevBlockIndexSize = pr_blockIndexSize;
 
                 // Create the new block
                 pr_blockIndexSize <<= 1;
+                while (pr_blockIndexSize < minIndexSize) {
+                    pr_blockIndexSize <<= 1;
+                }
                 auto newRawPtr = static_cast<char*>((Traits::malloc)(
                     sizeof(BlockIndexHeader) +
                     std::alignment_of<BlockIndexEntry>::value - 1 +
                     sizeof(BlockIndexEntry) * pr_blockIndexSize));
                 if (newRawPtr == nullptr) {
-                    pr_blockIndexSize >>= 1; // Reset to allow graceful retry
+                    pr_blockIndexSize =
+                        prevBlockIndexSize; // Reset to allow graceful retry
                     return false;
                 }
 
@@ -3091,6 +3876,15 @@ namespace moodycamel {
                     pr_blockIndexRaw; // we link the new block to the old one so
                                       // we can free it later
 
+                if (pr_blockIndexRaw != nullptr) {
+                    // Consumers that still see the old index can only be
+                    // dequeueing elements enqueued before this point: any
+                    // later element is published after the new index
+                    pr_retiredIndexTail =
+                        this->tailIndex.load(std::memory_order_relaxed);
+                    pr_hasRetiredIndices = true;
+                }
+
                 pr_blockIndexFront = j;
                 pr_blockIndexEntries = newBlockIndexEntries;
                 pr_blockIndexRaw = newRawPtr;
@@ -3099,6 +3893,62 @@ namespace moodycamel {
                 return true;
             }
 
+            // Frees the superseded block indices once no consumer can be
+            // using them, i.e. once every element below pr_retiredIndexTail
+            // has been dequeued *and* its slot marked empty (a consumer's
+            // last access to the index it loaded precedes the set_empty of
+            // its last element). Producer only.
+            void try_reclaim_block_indices() {
+                if (details::circular_less_than<index_t>(
+                        this->headIndex.load(std::memory_order_acquire),
+                        pr_retiredIndexTail)) {
+                    return;
+                }
+
+                if (pr_blockIndexSlotsUsed != 0) {
+                    // Bases in the index are consecutive, so the block of any
+                    // base can be found directly; blocks below the oldest
+                    // entry have been re-used, which requires them to be empty
+                    auto mask = pr_blockIndexSize - 1;
+                    auto oldestSlot =
+                        (pr_blockIndexFront - pr_blockIndexSlotsUsed) & mask;
+                    auto oldestBase = pr_blockIndexEntries[oldestSlot].base;
+                    auto base = details::circular_less_than<index_t>(
+                                    pr_reclaimCursor, oldestBase)
+                                    ? oldestBase
+                                    : pr_reclaimCursor;
+                    while (details::circular_less_than<index_t>(
+                        base, pr_retiredIndexTail)) {
+                        auto slot =
+                            (oldestSlot +
+                             static_cast<size_t>((base - oldestBase) /
+                                                 BLOCK_SIZE)) &
+                            mask;
+                        if (!pr_blockIndexEntries[slot]
+                                 .block->ConcurrentQueue::Block::
+                                 template is_empty<explicit_context>()) {
+                            // Blocks below stay empty until re-used; resume
+                            // from here next time
+                            pr_reclaimCursor = base;
+                            return;
+                        }
+                        base += static_cast<index_t>(BLOCK_SIZE);
+                    }
+                    pr_reclaimCursor = base;
+                }
+
+                auto header = static_cast<BlockIndexHeader*>(pr_blockIndexRaw);
+                auto prev = static_cast<BlockIndexHeader*>(header->prev);
+                header->prev = nullptr;
+                while (prev != nullptr) {
+                    auto next = static_cast<BlockIndexHeader*>(prev->prev);
+                    prev->~BlockIndexHeader();
+                    (Traits::free)(prev);
+                    prev = next;
+                }
+                pr_hasRetiredIndices = false;
+            }
+
         private:
             std::atomic<BlockIndexHeader*> blockIndex;
 
@@ -3110,6 +3960,13 @@ namespace moodycamel {
             BlockIndexEntry* pr_blockIndexEntries;
             void* pr_blockIndexRaw;
 
+            // Reclamation of superseded indices (chained through `prev`):
+            // tail at the time the newest one was superseded, and the base
+            // below which all blocks were already found empty
+            index_t pr_retiredIndexTail;
+            index_t pr_reclaimCursor;
+            bool pr_hasRetiredIndices;
+
 #ifdef MOODYCAMEL_QUEUE_INTERNAL_DEBUG
         public:
             ExplicitProducer* nextExplicitProducer;
@@ -3142,9 +3999,11 @@ namespace moodycamel {
                 // blocks can be only partially empty (all other remaining
                 // blocks must be completely full).
 
-#ifdef MOODYCAMEL_CPP11_THREAD_LOCAL_SUPPORTED
-                // Unregister ourselves for thread termination notification
-                if (!this->inactive.load(std::memory_order_relaxed)) {
+#ifdef MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
+                // Unregister ourselves for thread termination notification.
+                // Acquire: if the exit callback marked us inactive, it is
+                // done with us
+                if (!this->inactive.load(std::memory_order_acquire)) {
                     details::ThreadExitNotifier::unsubscribe(
                         &threadExitListener);
                 }
@@ -3941,7 +4800,7 @@ namespace moodycamel {
             size_t nextBlockIndexCapacity;
             std::atomic<BlockIndexHeader*> blockIndex;
 
-#ifdef MOODYCAMEL_CPP11_THREAD_LOCAL_SUPPORTED
+#ifdef MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
         public:
             details::ThreadExitListener threadExitListener;
 
@@ -4178,6 +5037,14 @@ namespace moodycamel {
         // Producer list manipulation
         //////////////////////////////////
 
+        static std::uint32_t fair_quantum(ProducerBase const* producer) {
+            auto weight = producer->weight.load(std::memory_order_relaxed);
+            auto quantum = static_cast<std::uint64_t>(FAIR_DEQUEUE_QUANTUM) *
+                           (weight == 0 ? 1 : weight);
+            return quantum > 0xFFFFFFFFu ? 0xFFFFFFFFu
+                                         : static_cast<std::uint32_t>(quantum);
+        }
+
         ProducerBase* recycle_or_create_producer(bool isExplicit) {
             bool recycled;
             return recycle_or_create_producer(isExplicit, recycled);
@@ -4200,6 +5067,9 @@ namespace moodycamel {
                             std::memory_order_relaxed)) {
                         // We caught one! It's been marked as activated, the
                         // caller can have it
+                        ptr->weight.store(1, std::memory_order_relaxed);
+                        ptr->locality.store(current_locality_domain(),
+                                            std::memory_order_relaxed);
                         recycled = true;
                         return ptr;
                     }
@@ -4429,7 +5299,7 @@ namespace moodycamel {
                                 probedKey = mainHash->entries[index].key.load(
                                     std::memory_order_relaxed);
                                 auto empty = details::invalid_thread_id;
-#ifdef MOODYCAMEL_CPP11_THREAD_LOCAL_SUPPORTED
+#ifdef MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
                                 auto reusable = details::invalid_thread_id2;
                                 if ((probedKey == empty &&
                                      mainHash->entries[index]
@@ -4543,7 +5413,7 @@ namespace moodycamel {
                             1, std::memory_order_relaxed);
                     }
 
-#ifdef MOODYCAMEL_CPP11_THREAD_LOCAL_SUPPORTED
+#ifdef MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
                     producer->threadExitListener.callback =
                         &ConcurrentQueue::
                             implicit_producer_thread_exited_callback;
@@ -4559,7 +5429,7 @@ namespace moodycamel {
                             std::memory_order_relaxed);
 
                         auto empty = details::invalid_thread_id;
-#ifdef MOODYCAMEL_CPP11_THREAD_LOCAL_SUPPORTED
+#ifdef MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
                         auto reusable = details::invalid_thread_id2;
                         if ((probedKey == empty &&
                              mainHash->entries[index]
@@ -4594,7 +5464,7 @@ namespace moodycamel {
             }
         }
 
-#ifdef MOODYCAMEL_CPP11_THREAD_LOCAL_SUPPORTED
+#ifdef MOODYCAMEL_THREAD_EXIT_NOTIFIER_SUPPORTED
         void implicit_producer_thread_exited(ImplicitProducer* producer) {
             // Remove from thread exit listeners
             details::ThreadExitNotifier::unsubscribe(
@@ -4771,17 +5641,29 @@ namespace moodycamel {
 
     template <typename T, typename Traits>
     ConsumerToken::ConsumerToken(ConcurrentQueue<T, Traits>& queue)
+        : ConsumerToken(queue, details::invalid_locality_domain) {}
+
+    template <typename T, typename Traits>
+    ConsumerToken::ConsumerToken(BlockingConcurrentQueue<T, Traits>& queue)
+        : ConsumerToken(queue, details::invalid_locality_domain) {}
+
+    template <typename T, typename Traits>
+    ConsumerToken::ConsumerToken(ConcurrentQueue<T, Traits>& queue,
+                                 std::uint32_t locality)
         : itemsConsumedFromCurrent(0), currentProducer(nullptr),
-          desiredProducer(nullptr) {
+          desiredProducer(nullptr), fairProducer(nullptr), fairDeficit(0),
+          locality(locality) {
         initialOffset = queue.nextExplicitConsumerId.fetch_add(
             1, std::memory_order_release);
         lastKnownGlobalOffset = static_cast<std::uint32_t>(-1);
     }
 
     template <typename T, typename Traits>
-    ConsumerToken::ConsumerToken(BlockingConcurrentQueue<T, Traits>& queue)
+    ConsumerToken::ConsumerToken(BlockingConcurrentQueue<T, Traits>& queue,
+                                 std::uint32_t locality)
         : itemsConsumedFromCurrent(0), currentProducer(nullptr),
-          desiredProducer(nullptr) {
+          desiredProducer(nullptr), fairProducer(nullptr), fairDeficit(0),
+          locality(locality) {
         initialOffset = reinterpret_cast<ConcurrentQueue<T, Traits>*>(&queue)
                             ->nextExplicitConsumerId.fetch_add(
                                 1, std::memory_order_release);
@@ -0,0 +1,245 @@
+// Conflating (latest-value-per-key) queue.
+//
+// Producers publish (key, value) updates, consumers see each dirty key once
+// with its latest value: updates to a key that has not been consumed yet
+// overwrite the pending value instead of queueing behind it. The backlog is
+// therefore bounded by the number of keys, and a hot key costs one value
+// store per update.
+//
+// Keys live in a fixed-size open-addressing table and are never removed, so
+// a slot index identifies a key for the queue's lifetime. Values are kept
+// under a per-slot seqlock in atomic words (Value must be trivially
+// copyable); readers never block writers. A slot's dirty flag decides
+// whether an update must also push the slot index onto a ConcurrentQueue of
+// dirty keys: only the update that flips it does, and consumers clear it
+// before reading the value, so no update is ever missed.
+
+#pragma once
+
+#include "conc.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+namespace utils {
+
+    template <typename Key, typename Value, typename Hash = std::hash<Key>,
+              typename KeyEqual = std::equal_to<Key>,
+              typename Traits = moodycamel::ConcurrentQueueDefaultTraits>
+    class ConflatingQueue final {
+        static_assert(std::is_trivially_copyable_v<Value>,
+                      "values are copied word by word under a seqlock");
+        static_assert(std::is_default_constructible_v<Key>,
+                      "keys are assigned into preallocated slots");
+
+    public:
+        /// @param max_keys distinct keys the table can hold; publishing a
+        /// new key beyond that fails
+        explicit ConflatingQueue(std::size_t max_keys)
+            : capacity_(TableSize(max_keys)), max_keys_(max_keys),
+              slots_(new Slot[capacity_]), dirty_(max_keys) {}
+
+        ConflatingQueue(const ConflatingQueue &) = delete;
+        auto operator=(const ConflatingQueue &) -> ConflatingQueue & = delete;
+
+        /// @brief Sets the latest value of `key`. Fails only if `key` is new
+        /// and the table already holds max_keys keys (or the dirty-key queue
+        /// cannot allocate). Thread-safe; concurrent updates of one key are
+        /// serialized by its seqlock.
+        auto Publish(const Key &key, const Value &value) -> bool {
+            auto slot = FindOrInsert(key);
+            if (slot == nullptr) {
+                return false;
+            }
+            Store(*slot, value);
+            if (!slot->dirty.exchange(true, std::memory_order_acq_rel)) {
+                if (!dirty_.enqueue(static_cast<std::uint32_t>(
+                        slot - slots_.get()))) {
+                    slot->dirty.store(false, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /// @brief Takes one dirty key and its latest value.
+        auto TryConsume(Key &key, Value &value) -> bool {
+            std::uint32_t index;
+            if (!dirty_.try_dequeue(index)) {
+                return false;
+            }
+            Take(slots_[index], key, value);
+            return true;
+        }
+
+        /// @brief Calls fn(const Key&, const Value&) for up to `max` dirty
+        /// keys; returns how many.
+        template <typename F>
+        auto ConsumeBulk(std::size_t max, F &&fn) -> std::size_t {
+            return dirty_.consume_bulk(max, [&](std::uint32_t index) {
+                auto &slot = slots_[index];
+                Value value;
+                Take(slot, value);
+                fn(static_cast<const Key &>(slot.key), value);
+            });
+        }
+
+        /// @brief Reads the latest value of `key` without consuming it.
+        auto TryGet(const Key &key, Value &value) const -> bool {
+            auto slot = Find(key);
+            if (slot == nullptr) {
+                return false;
+            }
+            Load(*slot, value);
+            return true;
+        }
+
+        /// @brief Approximate number of dirty keys.
+        auto SizeApprox() const -> std::size_t { return dirty_.size_approx(); }
+
+        auto KeyCount() const noexcept -> std::size_t {
+            return key_count_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr std::size_t kWords =
+            (sizeof(Value) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+        enum : std::uint8_t { kEmpty, kClaiming, kReady };
+
+        struct Slot {
+            std::atomic<std::uint8_t> state{kEmpty};
+            std::atomic<bool> dirty{false};
+            std::atomic<std::uint32_t> seq{0};
+            Key key{};
+            std::atomic<std::uint64_t> words[kWords]{};
+        };
+
+        // Load factor of at most one half keeps probe sequences short
+        static auto TableSize(std::size_t max_keys) -> std::size_t {
+            std::size_t size = 2;
+            while (size < 2 * max_keys) {
+                size <<= 1;
+            }
+            return size;
+        }
+
+        auto Find(const Key &key) const -> Slot * {
+            auto mask = capacity_ - 1;
+            for (auto i = Hash{}(key) & mask;; i = (i + 1) & mask) {
+                auto &slot = slots_[i];
+                auto state = slot.state.load(std::memory_order_acquire);
+                while (state == kClaiming) {
+                    std::this_thread::yield();
+                    state = slot.state.load(std::memory_order_acquire);
+                }
+                if (state == kEmpty) {
+                    return nullptr;
+                }
+                if (KeyEqual{}(slot.key, key)) {
+                    return &slot;
+                }
+            }
+        }
+
+        auto FindOrInsert(const Key &key) -> Slot * {
+            auto mask = capacity_ - 1;
+            for (auto i = Hash{}(key) & mask;; i = (i + 1) & mask) {
+                auto &slot = slots_[i];
+                auto state = slot.state.load(std::memory_order_acquire);
+                if (state == kEmpty) {
+                    if (key_count_.fetch_add(1, std::memory_order_relaxed) >=
+                        max_keys_) {
+                        key_count_.fetch_sub(1, std::memory_order_relaxed);
+                        // Another thread may be inserting this very key
+                        return Find(key);
+                    }
+                    std::uint8_t expected = kEmpty;
+                    if (slot.state.compare_exchange_strong(
+                            expected, kClaiming, std::memory_order_acquire,
+                            std::memory_order_acquire)) {
+                        slot.key = key;
+                        slot.state.store(kReady, std::memory_order_release);
+                        return &slot;
+                    }
+                    key_count_.fetch_sub(1, std::memory_order_relaxed);
+                    state = expected;
+                }
+                while (state == kClaiming) {
+                    std::this_thread::yield();
+                    state = slot.state.load(std::memory_order_acquire);
+                }
+                if (KeyEqual{}(slot.key, key)) {
+                    return &slot;
+                }
+            }
+        }
+
+        static void Store(Slot &slot, const Value &value) {
+            std::uint64_t words[kWords] = {};
+            std::memcpy(words, &value, sizeof(Value));
+            // Writers of one key take the seqlock in turn
+            auto seq = slot.seq.load(std::memory_order_relaxed);
+            while ((seq & 1) != 0 ||
+                   !slot.seq.compare_exchange_weak(seq, seq + 1,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed)) {
+                if ((seq & 1) != 0) {
+                    std::this_thread::yield();
+                    seq = slot.seq.load(std::memory_order_relaxed);
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            for (std::size_t i = 0; i != kWords; ++i) {
+                slot.words[i].store(words[i], std::memory_order_relaxed);
+            }
+            slot.seq.store(seq + 2, std::memory_order_release);
+        }
+
+        static void Load(const Slot &slot, Value &value) {
+            std::uint64_t words[kWords];
+            while (true) {
+                auto before = slot.seq.load(std::memory_order_acquire);
+                if ((before & 1) != 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (std::size_t i = 0; i != kWords; ++i) {
+                    words[i] = slot.words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) == before) {
+                    break;
+                }
+            }
+            std::memcpy(&value, words, sizeof(Value));
+        }
+
+        // Clearing the flag before reading makes any later update enqueue
+        // the key again. It is an exchange so that it acquires from the
+        // writers that found it set and did not enqueue: their values are
+        // then visible to the Load below
+        static void Take(Slot &slot, Value &value) {
+            slot.dirty.exchange(false, std::memory_order_acq_rel);
+            Load(slot, value);
+        }
+
+        static void Take(Slot &slot, Key &key, Value &value) {
+            Take(slot, value);
+            key = slot.key;
+        }
+
+        std::size_t capacity_;
+        std::size_t max_keys_;
+        std::unique_ptr<Slot[]> slots_;
+        std::atomic<std::size_t> key_count_{0};
+        moodycamel::ConcurrentQueue<std::uint32_t, Traits> dirty_;
+    };
+
+} // namespace utils
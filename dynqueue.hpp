@@ -0,0 +1,270 @@
+// ConcurrentQueue with a block size chosen at run time.
+//
+// BLOCK_SIZE and the initial block index sizes are compile-time Traits
+// constants, yet the best values depend on the host (cache sizes, core
+// count) and on the traffic pattern. IDynamicQueue<T> is a virtual facade
+// over a fixed set of pre-instantiated configurations; MakeDynamicQueue()
+// picks one from a configured block size and CalibrateBlockSize() from a
+// short benchmark run on the current host.
+//
+// Every call costs one indirect call; use the bulk operations on hot paths
+// so that it is paid once per batch rather than once per item. Tokens are
+// the queue's own moodycamel tokens, created through the facade, and are
+// only valid with the queue instance that created them.
+
+#pragma once
+
+#include "conc.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+    /// @brief Traits of one pre-instantiated configuration. The initial
+    /// index sizes are scaled so that every configuration indexes the same
+    /// number of elements (1024) before its first index reallocation.
+    template <std::size_t BlockSize>
+    struct BlockSizeTraits : moodycamel::ConcurrentQueueDefaultTraits {
+        static const std::size_t BLOCK_SIZE = BlockSize;
+        static const std::size_t EXPLICIT_INITIAL_INDEX_SIZE =
+            BlockSize >= 512 ? 2 : 1024 / BlockSize;
+        static const std::size_t IMPLICIT_INITIAL_INDEX_SIZE =
+            BlockSize >= 512 ? 2 : 1024 / BlockSize;
+    };
+
+    /// @brief Block sizes MakeDynamicQueue() can instantiate.
+    inline constexpr std::size_t kDynamicBlockSizes[] = {16, 32, 64, 128, 256};
+
+    template <typename T> class IDynamicQueue {
+    public:
+        virtual ~IDynamicQueue() = default;
+
+        virtual auto BlockSize() const noexcept -> std::size_t = 0;
+
+        virtual auto MakeProducerToken() -> moodycamel::ProducerToken = 0;
+        virtual auto MakeConsumerToken() -> moodycamel::ConsumerToken = 0;
+
+        virtual auto Enqueue(const T &item) -> bool = 0;
+        virtual auto Enqueue(T &&item) -> bool = 0;
+        virtual auto Enqueue(const moodycamel::ProducerToken &token,
+                             const T &item) -> bool = 0;
+        virtual auto Enqueue(const moodycamel::ProducerToken &token, T &&item)
+            -> bool = 0;
+        virtual auto EnqueueBulk(const T *items, std::size_t count) -> bool = 0;
+        virtual auto EnqueueBulk(const moodycamel::ProducerToken &token,
+                                 const T *items, std::size_t count) -> bool = 0;
+
+        virtual auto TryDequeue(T &item) -> bool = 0;
+        virtual auto TryDequeue(moodycamel::ConsumerToken &token, T &item)
+            -> bool = 0;
+        virtual auto TryDequeueBulk(T *items, std::size_t max)
+            -> std::size_t = 0;
+        virtual auto TryDequeueBulk(moodycamel::ConsumerToken &token, T *items,
+                                    std::size_t max) -> std::size_t = 0;
+
+        virtual auto SizeApprox() const -> std::size_t = 0;
+    };
+
+    template <typename T, typename Traits>
+    class DynamicQueue final : public IDynamicQueue<T> {
+    public:
+        explicit DynamicQueue(std::size_t capacity) : queue_(capacity) {}
+
+        auto BlockSize() const noexcept -> std::size_t override {
+            return Traits::BLOCK_SIZE;
+        }
+
+        auto MakeProducerToken() -> moodycamel::ProducerToken override {
+            return moodycamel::ProducerToken(queue_);
+        }
+
+        auto MakeConsumerToken() -> moodycamel::ConsumerToken override {
+            return moodycamel::ConsumerToken(queue_);
+        }
+
+        auto Enqueue(const T &item) -> bool override {
+            return queue_.enqueue(item);
+        }
+
+        auto Enqueue(T &&item) -> bool override {
+            return queue_.enqueue(std::move(item));
+        }
+
+        auto Enqueue(const moodycamel::ProducerToken &token, const T &item)
+            -> bool override {
+            return queue_.enqueue(token, item);
+        }
+
+        auto Enqueue(const moodycamel::ProducerToken &token, T &&item)
+            -> bool override {
+            return queue_.enqueue(token, std::move(item));
+        }
+
+        auto EnqueueBulk(const T *items, std::size_t count) -> bool override {
+            return queue_.enqueue_bulk(items, count);
+        }
+
+        auto EnqueueBulk(const moodycamel::ProducerToken &token, const T *items,
+                         std::size_t count) -> bool override {
+            return queue_.enqueue_bulk(token, items, count);
+        }
+
+        auto TryDequeue(T &item) -> bool override {
+            return queue_.try_dequeue(item);
+        }
+
+        auto TryDequeue(moodycamel::ConsumerToken &token, T &item)
+            -> bool override {
+            return queue_.try_dequeue(token, item);
+        }
+
+        auto TryDequeueBulk(T *items, std::size_t max) -> std::size_t override {
+            return queue_.try_dequeue_bulk(items, max);
+        }
+
+        auto TryDequeueBulk(moodycamel::ConsumerToken &token, T *items,
+                            std::size_t max) -> std::size_t override {
+            return queue_.try_dequeue_bulk(token, items, max);
+        }
+
+        auto SizeApprox() const -> std::size_t override {
+            return queue_.size_approx();
+        }
+
+    private:
+        moodycamel::ConcurrentQueue<T, Traits> queue_;
+    };
+
+    /// @brief Creates a queue with the supported block size closest to
+    /// `block_size` (rounded up, clamped to kDynamicBlockSizes).
+    template <typename T>
+    auto MakeDynamicQueue(std::size_t block_size, std::size_t capacity = 0)
+        -> std::unique_ptr<IDynamicQueue<T>> {
+        auto make = [capacity](auto traits)
+            -> std::unique_ptr<IDynamicQueue<T>> {
+            using Traits = decltype(traits);
+            return std::make_unique<DynamicQueue<T, Traits>>(
+                capacity == 0 ? 6 * Traits::BLOCK_SIZE : capacity);
+        };
+        if (block_size <= 16) {
+            return make(BlockSizeTraits<16>{});
+        }
+        if (block_size <= 32) {
+            return make(BlockSizeTraits<32>{});
+        }
+        if (block_size <= 64) {
+            return make(BlockSizeTraits<64>{});
+        }
+        if (block_size <= 128) {
+            return make(BlockSizeTraits<128>{});
+        }
+        return make(BlockSizeTraits<256>{});
+    }
+
+    struct CalibrationOptions {
+        unsigned producers = 2;
+        unsigned consumers = 2;
+        /// Items enqueued by each producer per trial
+        std::size_t items_per_producer = 1 << 15;
+        /// Items per enqueue/dequeue bulk call, 1 for single-item calls
+        std::size_t batch = 16;
+        /// Trials per block size; the fastest one counts
+        unsigned trials = 3;
+    };
+
+    /// @brief Times a producer/consumer run for every block size in
+    /// kDynamicBlockSizes and returns the fastest one. Takes a few tens of
+    /// milliseconds with the default options; meant to run once at startup.
+    template <typename T>
+    auto CalibrateBlockSize(const CalibrationOptions &options = {})
+        -> std::size_t {
+        auto producers = options.producers == 0 ? 1U : options.producers;
+        auto consumers = options.consumers == 0 ? 1U : options.consumers;
+        std::size_t batch = options.batch == 0 ? 1 : options.batch;
+        // Producers enqueue whole batches
+        auto per_producer = (options.items_per_producer + batch - 1) / batch;
+        auto total = per_producer * batch * producers;
+
+        // A trial whose enqueues failed did not move `total` items and
+        // must not win
+        auto trial = [&](IDynamicQueue<T> &queue) {
+            std::atomic<std::size_t> enqueued{0};
+            std::atomic<std::size_t> dequeued{0};
+            std::atomic<unsigned> producing{producers};
+            std::atomic<bool> go{false};
+            std::vector<std::thread> threads;
+            threads.reserve(producers + consumers);
+            for (unsigned p = 0; p != producers; ++p) {
+                threads.emplace_back([&] {
+                    auto token = queue.MakeProducerToken();
+                    std::vector<T> items(batch);
+                    while (!go.load(std::memory_order_acquire)) {
+                    }
+                    for (std::size_t i = 0; i != per_producer; ++i) {
+                        if (queue.EnqueueBulk(token, items.data(), batch)) {
+                            enqueued.fetch_add(batch, std::memory_order_relaxed);
+                        }
+                    }
+                    producing.fetch_sub(1, std::memory_order_release);
+                });
+            }
+            for (unsigned c = 0; c != consumers; ++c) {
+                threads.emplace_back([&] {
+                    auto token = queue.MakeConsumerToken();
+                    std::vector<T> items(batch);
+                    while (!go.load(std::memory_order_acquire)) {
+                    }
+                    while (true) {
+                        auto count =
+                            queue.TryDequeueBulk(token, items.data(), batch);
+                        if (count != 0) {
+                            dequeued.fetch_add(count, std::memory_order_relaxed);
+                            continue;
+                        }
+                        // Acquire: once the producers are done, `enqueued`
+                        // is final
+                        if (producing.load(std::memory_order_acquire) == 0 &&
+                            dequeued.load(std::memory_order_relaxed) >=
+                                enqueued.load(std::memory_order_relaxed)) {
+                            break;
+                        }
+                    }
+                });
+            }
+            auto start = std::chrono::steady_clock::now();
+            go.store(true, std::memory_order_release);
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            if (enqueued.load(std::memory_order_relaxed) != total) {
+                return std::chrono::steady_clock::duration::max();
+            }
+            return elapsed;
+        };
+
+        // Warm up the allocator and the threads before anything is timed
+        trial(*MakeDynamicQueue<T>(kDynamicBlockSizes[0]));
+
+        std::size_t best_size = 32;
+        auto best_time = std::chrono::steady_clock::duration::max();
+        for (auto block_size : kDynamicBlockSizes) {
+            for (unsigned t = 0; t != options.trials; ++t) {
+                auto queue = MakeDynamicQueue<T>(block_size);
+                auto elapsed = trial(*queue);
+                if (elapsed < best_time) {
+                    best_time = elapsed;
+                    best_size = block_size;
+                }
+            }
+        }
+        return best_size;
+    }
+
+} // namespace utils
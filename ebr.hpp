@@ -0,0 +1,347 @@
+// Epoch-based memory reclamation (EBR) for the engine's lock-free structures.
+//
+// Readers enter a critical section with EpochDomain::Guard; the cost is one
+// load of the global epoch, one store and one fence, no matter how many
+// objects are read -- reads are wait-free. Writers unlink an object and hand
+// it to Participant::Retire(); the object is kept on the participant's limbo
+// list until every thread that could still see it has left its critical
+// section, and then freed together with everything else retired in the same
+// epoch.
+//
+// The classic three-epoch scheme is used: an object retired in epoch `e` can
+// be freed once the global epoch reached `e + 2`, and the global epoch only
+// advances when every active participant has observed the current one.
+//
+// Participants follow the same model as moodycamel::ProducerToken: one per
+// thread, created explicitly, recycled by the domain once destroyed.
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+    /// @brief Domain of epoch-based memory reclamation.
+    ///
+    /// A domain is shared by all threads touching the same set of lock-free
+    /// structures. Every thread registers once through a Participant and
+    /// wraps each access to shared nodes in a Guard.
+    ///
+    /// ## Example usage:
+    /// @code
+    /// utils::EpochDomain domain;
+    ///
+    /// // reader thread
+    /// utils::EpochDomain::Participant self(domain);
+    /// {
+    ///     utils::EpochDomain::Guard guard(self);
+    ///     auto* node = head.load(std::memory_order_acquire);
+    ///     Use(node);
+    /// }
+    ///
+    /// // writer thread
+    /// auto* old = head.exchange(fresh, std::memory_order_acq_rel);
+    /// writer.Retire(old);
+    /// @endcode
+    class EpochDomain final {
+    public:
+        /// @brief Number of retired objects after which a participant tries
+        /// to advance the global epoch and free its limbo lists.
+        static constexpr std::size_t kRetireBatch = 64;
+
+        class Participant;
+        class Guard;
+
+        EpochDomain() = default;
+
+        EpochDomain(const EpochDomain &) = delete;
+        auto operator=(const EpochDomain &) -> EpochDomain & = delete;
+
+        /// @brief Frees everything still on the limbo lists. No participant
+        /// may be alive at this point.
+        ~EpochDomain() {
+            auto record = records_.load(std::memory_order_relaxed);
+            while (record != nullptr) {
+                assert(!record->in_use.load(std::memory_order_relaxed) &&
+                       "all participants must be destroyed before the domain");
+                auto next = record->next;
+                for (auto &bucket : record->limbo) {
+                    FreeAll(bucket.retired);
+                }
+                delete record;
+                record = next;
+            }
+        }
+
+        /// @brief Current global epoch; mostly useful for diagnostics.
+        auto Epoch() const noexcept -> std::uint64_t {
+            return global_epoch_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        using Deleter = void (*)(void *);
+
+        struct Retired {
+            void *ptr;
+            Deleter deleter;
+        };
+
+        struct Limbo {
+            std::uint64_t epoch = 0;
+            std::vector<Retired> retired{};
+        };
+
+        // The low bit of `epoch` tells whether the owner is inside a critical
+        // section; the rest is the global epoch it observed on entry.
+        static constexpr std::uint64_t kActive = 1;
+
+        struct alignas(64) Record {
+            std::atomic<std::uint64_t> epoch{0};
+            std::atomic<bool> in_use{true};
+            Record *next = nullptr;
+
+            // Owned by the participant currently holding the record
+            Limbo limbo[3];
+            std::size_t retired_since_scan = 0;
+            std::uint32_t nesting = 0;
+        };
+
+        auto Acquire() -> Record * {
+            // Try to re-use a record released by a finished thread first
+            for (auto record = records_.load(std::memory_order_acquire);
+                 record != nullptr; record = record->next) {
+                bool expected = false;
+                if (!record->in_use.load(std::memory_order_relaxed) &&
+                    record->in_use.compare_exchange_strong(
+                        expected, true, std::memory_order_acquire,
+                        std::memory_order_relaxed)) {
+                    return record;
+                }
+            }
+
+            auto record = new Record;
+            auto head = records_.load(std::memory_order_relaxed);
+            do {
+                record->next = head;
+            } while (!records_.compare_exchange_weak(
+                head, record, std::memory_order_release,
+                std::memory_order_relaxed));
+            return record;
+        }
+
+        void Release(Record *record) noexcept {
+            assert(record->nesting == 0 && "participant destroyed in a guard");
+            // Whatever is left in limbo stays there; the next owner of the
+            // record (or the domain destructor) frees it.
+            record->in_use.store(false, std::memory_order_release);
+        }
+
+        void Enter(Record *record) noexcept {
+            if (record->nesting++ != 0) {
+                return;
+            }
+            auto epoch = global_epoch_.load(std::memory_order_relaxed);
+            record->epoch.store((epoch << 1) | kActive,
+                                std::memory_order_relaxed);
+            // The announcement must be visible before any shared pointer is
+            // read, otherwise a writer could advance past us unnoticed.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        void Exit(Record *record) noexcept {
+            assert(record->nesting != 0);
+            if (--record->nesting != 0) {
+                return;
+            }
+            record->epoch.store(0, std::memory_order_release);
+        }
+
+        void Retire(Record *record, void *ptr, Deleter deleter) {
+            auto epoch = global_epoch_.load(std::memory_order_acquire);
+            auto &bucket = record->limbo[epoch % 3];
+            if (bucket.epoch != epoch) {
+                // The bucket holds objects from epoch - 3 or earlier, which
+                // are already unreachable for everybody.
+                FreeAll(bucket.retired);
+                bucket.epoch = epoch;
+            }
+            bucket.retired.push_back({ptr, deleter});
+
+            if (++record->retired_since_scan >= kRetireBatch) {
+                record->retired_since_scan = 0;
+                TryAdvance();
+                Collect(record);
+            }
+        }
+
+        // Bumps the global epoch if every active participant has seen it
+        auto TryAdvance() noexcept -> bool {
+            auto epoch = global_epoch_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (auto record = records_.load(std::memory_order_acquire);
+                 record != nullptr; record = record->next) {
+                auto observed = record->epoch.load(std::memory_order_relaxed);
+                if ((observed & kActive) != 0 && (observed >> 1) != epoch) {
+                    return false;
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return global_epoch_.compare_exchange_strong(
+                epoch, epoch + 1, std::memory_order_acq_rel,
+                std::memory_order_relaxed);
+        }
+
+        void Collect(Record *record) {
+            auto epoch = global_epoch_.load(std::memory_order_acquire);
+            for (auto &bucket : record->limbo) {
+                if (!bucket.retired.empty() && bucket.epoch + 2 <= epoch) {
+                    FreeAll(bucket.retired);
+                }
+            }
+        }
+
+        static void FreeAll(std::vector<Retired> &retired) noexcept {
+            for (auto &item : retired) {
+                item.deleter(item.ptr);
+            }
+            retired.clear();
+        }
+
+        alignas(64) std::atomic<std::uint64_t> global_epoch_{0};
+        alignas(64) std::atomic<Record *> records_{nullptr};
+    };
+
+    /// @brief Per-thread registration in an EpochDomain.
+    ///
+    /// Must only be used by one thread at a time. Destroying it hands its
+    /// record (and any objects still in limbo) back to the domain.
+    class EpochDomain::Participant final {
+    public:
+        explicit Participant(EpochDomain &domain)
+            : domain_(&domain), record_(domain.Acquire()) {}
+
+        Participant(Participant &&other) noexcept
+            : domain_(std::exchange(other.domain_, nullptr)),
+              record_(std::exchange(other.record_, nullptr)) {}
+
+        auto operator=(Participant &&other) noexcept -> Participant & {
+            std::swap(domain_, other.domain_);
+            std::swap(record_, other.record_);
+            return *this;
+        }
+
+        Participant(const Participant &) = delete;
+        auto operator=(const Participant &) -> Participant & = delete;
+
+        ~Participant() {
+            if (record_ != nullptr) {
+                domain_->Release(record_);
+            }
+        }
+
+        /// @brief Schedules `ptr` for `delete` once no reader can hold it.
+        /// `ptr` must already be unreachable for new readers.
+        template <typename T> void Retire(T *ptr) {
+            domain_->Retire(record_, ptr, [](void *p) {
+                delete static_cast<T *>(p);
+            });
+        }
+
+        /// @brief Same as Retire(ptr) with a custom deleter.
+        void Retire(void *ptr, void (*deleter)(void *)) {
+            domain_->Retire(record_, ptr, deleter);
+        }
+
+        /// @brief Tries to advance the epoch and frees whatever became safe.
+        /// Useful on idle paths so that limbo lists do not wait for the next
+        /// batch of retirements.
+        void Flush() {
+            domain_->TryAdvance();
+            domain_->Collect(record_);
+        }
+
+    private:
+        friend class EpochDomain::Guard;
+
+        EpochDomain *domain_;
+        EpochDomain::Record *record_;
+    };
+
+    /// @brief RAII critical section; shared nodes read while it is alive stay
+    /// valid. Guards nest.
+    class EpochDomain::Guard final {
+    public:
+        explicit Guard(Participant &self) noexcept : self_(self) {
+            self_.domain_->Enter(self_.record_);
+        }
+
+        ~Guard() { self_.domain_->Exit(self_.record_); }
+
+        Guard(const Guard &) = delete;
+        auto operator=(const Guard &) -> Guard & = delete;
+
+    private:
+        Participant &self_;
+    };
+
+    /// @brief RCU-style holder of an immutable, rarely changing value.
+    ///
+    /// Readers get the current snapshot with a single acquire load and no
+    /// refcount traffic; the snapshot stays valid for as long as the reader
+    /// is inside an EpochDomain::Guard of the domain passed at construction
+    /// (or, on the writer's own thread, until the next update). Writers are
+    /// serialized, copy the current snapshot, modify the copy and publish
+    /// it; the superseded version is retired through the epoch domain.
+    template <typename T> class RcuCell final {
+    public:
+        template <typename... Args>
+        explicit RcuCell(EpochDomain &domain, Args &&...args)
+            : domain_(domain),
+              current_(new T(std::forward<Args>(args)...)) {}
+
+        RcuCell(const RcuCell &) = delete;
+        auto operator=(const RcuCell &) -> RcuCell & = delete;
+
+        ~RcuCell() { delete current_.load(std::memory_order_relaxed); }
+
+        auto Load() const noexcept -> const T * {
+            return current_.load(std::memory_order_acquire);
+        }
+
+        auto Domain() const noexcept -> EpochDomain & { return domain_; }
+
+        /// @brief Replaces the snapshot with `next`.
+        void Publish(EpochDomain::Participant &writer,
+                     std::unique_ptr<T> next) {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            auto old = current_.exchange(next.release(),
+                                         std::memory_order_acq_rel);
+            writer.Retire(old);
+        }
+
+        /// @brief Publishes a copy of the current snapshot modified by `fn`.
+        template <typename Fn>
+        void Update(EpochDomain::Participant &writer, Fn &&fn) {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            auto next = std::make_unique<T>(
+                *current_.load(std::memory_order_relaxed));
+            std::forward<Fn>(fn)(*next);
+            auto old = current_.exchange(next.release(),
+                                         std::memory_order_acq_rel);
+            writer.Retire(old);
+        }
+
+    private:
+        EpochDomain &domain_;
+        std::atomic<T *> current_;
+        std::mutex write_mutex_;
+    };
+
+} // namespace utils
@@ -0,0 +1,330 @@
+// Asynchronous structured logger on top of moodycamel::ConcurrentQueue.
+//
+// A log call on the hot path does not format anything: it packs a pointer to
+// a static call-site descriptor (level, format string, file, line), a
+// timestamp and up to kMaxLogArgs scalar arguments into a fixed-size binary
+// LogRecord and enqueues it. Tokenless enqueueing uses the queue's implicit
+// producers, i.e. every thread writes into its own sub-queue without
+// contending with other producers. A single background thread drains the
+// queue in bulk, formats the records and writes them to the sink in batches.
+//
+// String arguments are stored by pointer and must outlive the background
+// thread -- use literals or other static strings only.
+
+#pragma once
+
+#include "conc.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+namespace utils {
+
+    enum class LogLevel : std::uint8_t {
+        kTrace = 0,
+        kDebug = 1,
+        kInfo = 2,
+        kWarning = 3,
+        kError = 4
+    };
+
+    /// @brief Static description of a log call site; its address serves as
+    /// the format-string ID stored in every record.
+    struct LogSite {
+        LogLevel level;
+        const char *format; // "{}" placeholders, one per argument
+        const char *file;
+        int line;
+    };
+
+    inline constexpr std::size_t kMaxLogArgs = 6;
+
+    namespace log_detail {
+        enum class ArgType : std::uint8_t {
+            kBool,
+            kChar,
+            kInt,
+            kUInt,
+            kDouble,
+            kString,
+            kPointer
+        };
+
+        struct Arg {
+            ArgType type;
+            union {
+                long long i;
+                unsigned long long u;
+                double d;
+                const char *s;
+                const void *p;
+            };
+        };
+
+        inline auto MakeArg(bool v) noexcept -> Arg {
+            Arg a{ArgType::kBool, {}};
+            a.i = v ? 1 : 0;
+            return a;
+        }
+
+        inline auto MakeArg(char v) noexcept -> Arg {
+            Arg a{ArgType::kChar, {}};
+            a.i = v;
+            return a;
+        }
+
+        inline auto MakeArg(double v) noexcept -> Arg {
+            Arg a{ArgType::kDouble, {}};
+            a.d = v;
+            return a;
+        }
+
+        inline auto MakeArg(float v) noexcept -> Arg {
+            return MakeArg(static_cast<double>(v));
+        }
+
+        inline auto MakeArg(const char *v) noexcept -> Arg {
+            Arg a{ArgType::kString, {}};
+            a.s = v;
+            return a;
+        }
+
+        inline auto MakeArg(const void *v) noexcept -> Arg {
+            Arg a{ArgType::kPointer, {}};
+            a.p = v;
+            return a;
+        }
+
+        template <typename T,
+                  typename = std::enable_if_t<std::is_integral_v<T> ||
+                                              std::is_enum_v<T>>>
+        inline auto MakeArg(T v) noexcept -> Arg {
+            if constexpr (std::is_enum_v<T>) {
+                return MakeArg(static_cast<std::underlying_type_t<T>>(v));
+            } else if constexpr (std::is_signed_v<T>) {
+                Arg a{ArgType::kInt, {}};
+                a.i = static_cast<long long>(v);
+                return a;
+            } else {
+                Arg a{ArgType::kUInt, {}};
+                a.u = static_cast<unsigned long long>(v);
+                return a;
+            }
+        }
+    } // namespace log_detail
+
+    /// @brief Compact binary log record; trivially copyable.
+    struct LogRecord {
+        const LogSite *site;
+        std::int64_t timestamp_ns;
+        std::uint64_t thread;
+        std::uint8_t argc;
+        log_detail::Arg args[kMaxLogArgs];
+    };
+
+    /// @brief Logger with per-thread queues and a background formatter.
+    class AsyncLogger final {
+    public:
+        /// @brief Records taken from the queue per bulk dequeue.
+        static constexpr std::size_t kBatchSize = 256;
+
+        explicit AsyncLogger(
+            std::FILE *sink = stderr, LogLevel min_level = LogLevel::kInfo,
+            std::chrono::milliseconds flush_interval =
+                std::chrono::milliseconds(1))
+            : sink_(sink), min_level_(min_level),
+              flush_interval_(flush_interval),
+              worker_([this] { Run(); }) {}
+
+        AsyncLogger(const AsyncLogger &) = delete;
+        auto operator=(const AsyncLogger &) -> AsyncLogger & = delete;
+
+        /// @brief Drains everything that was logged and stops the thread.
+        ~AsyncLogger() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wakeup_.notify_one();
+            worker_.join();
+        }
+
+        auto Enabled(LogLevel level) const noexcept -> bool {
+            return level >= min_level_.load(std::memory_order_relaxed);
+        }
+
+        void SetMinLevel(LogLevel level) noexcept {
+            min_level_.store(level, std::memory_order_relaxed);
+        }
+
+        /// @brief Hot-path entry point; prefer the ID_LOG macro.
+        template <typename... Args>
+        void Log(const LogSite &site, const Args &...args) noexcept {
+            static_assert(sizeof...(Args) <= kMaxLogArgs,
+                          "too many arguments for a single log record");
+            if (!Enabled(site.level)) {
+                return;
+            }
+            LogRecord record;
+            record.site = &site;
+            record.timestamp_ns =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count();
+            record.thread =
+                static_cast<std::uint64_t>(moodycamel::details::hash_thread_id(
+                    moodycamel::details::thread_id()));
+            record.argc = static_cast<std::uint8_t>(sizeof...(Args));
+            std::size_t i = 0;
+            ((record.args[i++] = log_detail::MakeArg(args)), ...);
+            (void)i;
+            if (!queue_.enqueue(record)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        /// @brief Blocks until every record logged before the call by this
+        /// thread has been written and the sink flushed.
+        void Flush() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto target = ++flush_requested_;
+            wakeup_.notify_one();
+            flushed_cv_.wait(lock, [&] { return flush_done_ >= target; });
+        }
+
+        /// @brief Records lost because the queue could not allocate.
+        auto Dropped() const noexcept -> std::uint64_t {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void Run() {
+            moodycamel::ConsumerToken token(queue_);
+            LogRecord batch[kBatchSize];
+            std::string out;
+            out.reserve(kBatchSize * 128);
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                wakeup_.wait_for(lock, flush_interval_, [&] {
+                    return stop_ || flush_requested_ != flush_done_;
+                });
+                auto stopping = stop_;
+                auto requested = flush_requested_;
+                lock.unlock();
+
+                std::size_t count;
+                while ((count = queue_.try_dequeue_bulk(token, batch,
+                                                        kBatchSize)) != 0) {
+                    for (std::size_t i = 0; i != count; ++i) {
+                        Format(batch[i], out);
+                    }
+                    std::fwrite(out.data(), 1, out.size(), sink_);
+                    out.clear();
+                }
+                std::fflush(sink_);
+
+                lock.lock();
+                if (requested != flush_done_) {
+                    flush_done_ = requested;
+                    flushed_cv_.notify_all();
+                }
+                if (stopping) {
+                    return;
+                }
+            }
+        }
+
+        static void Format(const LogRecord &record, std::string &out) {
+            static constexpr const char *kLevelNames[] = {"TRACE", "DEBUG",
+                                                          "INFO", "WARN",
+                                                          "ERROR"};
+            char buffer[64];
+            auto seconds = record.timestamp_ns / 1000000000;
+            auto nanos = record.timestamp_ns % 1000000000;
+            auto n = std::snprintf(
+                buffer, sizeof(buffer), "%lld.%09lld [%s] [%08llx] ",
+                static_cast<long long>(seconds), static_cast<long long>(nanos),
+                kLevelNames[static_cast<int>(record.site->level)],
+                static_cast<unsigned long long>(record.thread & 0xFFFFFFFFU));
+            out.append(buffer, static_cast<std::size_t>(n));
+
+            std::size_t next_arg = 0;
+            for (auto p = record.site->format; *p != '\0'; ++p) {
+                if (p[0] == '{' && p[1] == '}' && next_arg < record.argc) {
+                    AppendArg(record.args[next_arg++], out);
+                    ++p;
+                } else {
+                    out.push_back(*p);
+                }
+            }
+            n = std::snprintf(buffer, sizeof(buffer), " (%s:%d)\n",
+                              record.site->file, record.site->line);
+            out.append(buffer, static_cast<std::size_t>(n));
+        }
+
+        static void AppendArg(const log_detail::Arg &arg, std::string &out) {
+            using log_detail::ArgType;
+            char buffer[32];
+            int n = 0;
+            switch (arg.type) {
+                case ArgType::kBool:
+                    out.append(arg.i != 0 ? "true" : "false");
+                    return;
+                case ArgType::kChar:
+                    out.push_back(static_cast<char>(arg.i));
+                    return;
+                case ArgType::kInt:
+                    n = std::snprintf(buffer, sizeof(buffer), "%lld", arg.i);
+                    break;
+                case ArgType::kUInt:
+                    n = std::snprintf(buffer, sizeof(buffer), "%llu", arg.u);
+                    break;
+                case ArgType::kDouble:
+                    n = std::snprintf(buffer, sizeof(buffer), "%g", arg.d);
+                    break;
+                case ArgType::kString:
+                    out.append(arg.s != nullptr ? arg.s : "(null)");
+                    return;
+                case ArgType::kPointer:
+                    n = std::snprintf(buffer, sizeof(buffer), "%p", arg.p);
+                    break;
+            }
+            out.append(buffer, static_cast<std::size_t>(n));
+        }
+
+        moodycamel::ConcurrentQueue<LogRecord> queue_{};
+        std::FILE *sink_;
+        std::atomic<LogLevel> min_level_;
+        std::chrono::milliseconds flush_interval_;
+        std::atomic<std::uint64_t> dropped_{0};
+
+        std::mutex mutex_{};
+        std::condition_variable wakeup_{};
+        std::condition_variable flushed_cv_{};
+        std::uint64_t flush_requested_ = 0;
+        std::uint64_t flush_done_ = 0;
+        bool stop_ = false;
+
+        // Declared last so that everything above is initialized first
+        std::thread worker_;
+    };
+
+} // namespace utils
+
+/// @brief Logs through `logger` with a static call-site descriptor:
+/// ID_LOG(logger, utils::LogLevel::kInfo, "took {} us", elapsed);
+#define ID_LOG(logger, level, format, ...)                                     \
+    do {                                                                       \
+        static constexpr ::utils::LogSite id_log_site_{(level), (format),     \
+                                                        __FILE__, __LINE__};   \
+        (logger).Log(id_log_site_, ##__VA_ARGS__);                             \
+    } while (false)
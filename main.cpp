@@ -1,12 +1,27 @@
-#include <iostream>
-
+#include "aio.hpp"
+#include "conc.hpp"
+#include "dynqueue.hpp"
+#include "ebr.hpp"
+#include "logger.hpp"
+#include "mpsc.hpp"
+#include "parking.hpp"
+#include "wire.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <new>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 
@@ -117,6 +132,126 @@ namespace utils {
         }
     };
 
+    /// @brief Move-only polymorphic value: holds any type derived from
+    /// Base, inline when it fits.
+    ///
+    /// Like FastPimpl the object lives in aligned storage inside the
+    /// holder, so a vector of holders keeps its objects contiguous and
+    /// reaching one is no pointer chase. Types larger than Size, more
+    /// aligned than Alignment, or not nothrow movable go to the heap
+    /// instead; IsInline() tells which happened.
+    template <class Base, std::size_t Size,
+              std::size_t Alignment = alignof(std::max_align_t)>
+    class InlinePoly final {
+    public:
+        template <class T>
+        static constexpr bool kFitsInline =
+            sizeof(T) <= Size && Alignment % alignof(T) == 0 &&
+            std::is_nothrow_move_constructible_v<T>;
+
+        InlinePoly() noexcept = default;
+
+        template <class T, class... Args>
+        explicit InlinePoly(std::in_place_type_t<T>, Args &&...args) {
+            static_assert(std::is_convertible_v<T *, Base *>,
+                          "T must derive from Base");
+            if constexpr (kFitsInline<T>) {
+                ptr_ = ::new (static_cast<void *>(&storage_))
+                    T(std::forward<Args>(args)...);
+            } else {
+                ptr_ = new T(std::forward<Args>(args)...);
+            }
+            ops_ = &kOps<T>;
+        }
+
+        template <class T, class U = std::decay_t<T>,
+                  class = std::enable_if_t<!std::is_same_v<U, InlinePoly>>>
+        // NOLINTNEXTLINE(google-explicit-constructor)
+        InlinePoly(T &&value)
+            : InlinePoly(std::in_place_type<U>, std::forward<T>(value)) {}
+
+        InlinePoly(InlinePoly &&other) noexcept { MoveFrom(other); }
+
+        auto operator=(InlinePoly &&other) noexcept -> InlinePoly & {
+            if (this != &other) {
+                Reset();
+                MoveFrom(other);
+            }
+            return *this;
+        }
+
+        InlinePoly(const InlinePoly &) = delete;
+        auto operator=(const InlinePoly &) -> InlinePoly & = delete;
+
+        ~InlinePoly() { Reset(); }
+
+        void Reset() noexcept {
+            if (ops_ != nullptr) {
+                ops_->destroy(ptr_);
+                ops_ = nullptr;
+                ptr_ = nullptr;
+            }
+        }
+
+        auto IsInline() const noexcept -> bool {
+            return ops_ != nullptr && ops_->is_inline;
+        }
+
+        explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+        auto Get() noexcept -> Base * { return ptr_; }
+        auto Get() const noexcept -> const Base * { return ptr_; }
+
+        auto operator->() noexcept -> Base * { return ptr_; }
+        auto operator->() const noexcept -> const Base * { return ptr_; }
+
+        auto operator*() noexcept -> Base & { return *ptr_; }
+        auto operator*() const noexcept -> const Base & { return *ptr_; }
+
+    private:
+        struct Ops {
+            bool is_inline;
+            // Relocates the object of `src` into `dst`, returning its new
+            // Base pointer; `src` is left without an object
+            Base *(*move)(void *dst, Base *src) noexcept;
+            void (*destroy)(Base *) noexcept;
+        };
+
+        template <class T>
+        static constexpr Ops kOps = {
+            kFitsInline<T>,
+            [](void *dst, Base *src) noexcept -> Base * {
+                if constexpr (kFitsInline<T>) {
+                    auto from = static_cast<T *>(src);
+                    auto to = ::new (dst) T(std::move(*from));
+                    from->~T();
+                    return to;
+                } else {
+                    return src;
+                }
+            },
+            [](Base *self) noexcept {
+                if constexpr (kFitsInline<T>) {
+                    static_cast<T *>(self)->~T();
+                } else {
+                    delete static_cast<T *>(self);
+                }
+            },
+        };
+
+        void MoveFrom(InlinePoly &other) noexcept {
+            if (other.ops_ != nullptr) {
+                ptr_ = other.ops_->move(&storage_, other.ptr_);
+                ops_ = std::exchange(other.ops_, nullptr);
+                other.ptr_ = nullptr;
+            }
+        }
+
+        alignas(Alignment) std::byte storage_[Size];
+        Base *ptr_ = nullptr;
+        const Ops *ops_ = nullptr;
+    };
+
 } // namespace utils
 
 // namespace Patterns {
@@ -476,12 +611,152 @@ namespace utils {
 //     } // end of namespace Observer
 // } // end of namespace Patterns
 
+namespace ic {
+    namespace eng {
+        /// Lifecycle of a unit.
+        enum class UnitState : std::uint8_t {
+            kCreated,
+            kQueued,    // on an executor run queue, about to run
+            kRunning,
+            kWaiting,   // idle, or blocked on messages or dependencies
+            kCompleted,
+            kCancelled,
+        };
+
+        namespace detail {
+            constexpr auto UnitStateBit(UnitState state) -> std::uint8_t {
+                return static_cast<std::uint8_t>(1U << static_cast<unsigned>(state));
+            }
+
+            // Allowed targets per source state. Queued and Running units are
+            // referenced by an executor, so only idle units can be cancelled
+            constexpr std::uint8_t kUnitTransitions[] = {
+                /* kCreated   */ UnitStateBit(UnitState::kQueued) |
+                    UnitStateBit(UnitState::kWaiting) |
+                    UnitStateBit(UnitState::kCancelled),
+                /* kQueued    */ UnitStateBit(UnitState::kRunning),
+                /* kRunning   */ UnitStateBit(UnitState::kQueued) |
+                    UnitStateBit(UnitState::kWaiting) |
+                    UnitStateBit(UnitState::kCompleted),
+                /* kWaiting   */ UnitStateBit(UnitState::kQueued) |
+                    UnitStateBit(UnitState::kCancelled),
+                /* kCompleted */ 0,
+                /* kCancelled */ 0,
+            };
+        } // namespace detail
+
+        constexpr auto IsTerminal(UnitState state) -> bool {
+            return detail::kUnitTransitions[static_cast<std::size_t>(state)] == 0;
+        }
+
+        /// Staying in a state is allowed, except in a terminal one.
+        constexpr auto IsTransitionAllowed(UnitState from, UnitState to) -> bool {
+            return from == to
+                       ? !IsTerminal(from)
+                       : (detail::kUnitTransitions[static_cast<std::size_t>(from)] &
+                          detail::UnitStateBit(to)) != 0;
+        }
+
+        static_assert(!IsTransitionAllowed(UnitState::kQueued, UnitState::kCancelled));
+        static_assert(IsTransitionAllowed(UnitState::kWaiting, UnitState::kQueued));
+
+        /**
+         * A unit's state and a counter packed into one atomic word; every
+         * check is one load and every transition one CAS, never a lock.
+         *
+         * The counter belongs to whoever drives the unit: pending messages
+         * for actors, unfinished dependencies for graph nodes. It is signed.
+         */
+        class UnitLifecycle {
+        public:
+            struct Snapshot {
+                UnitState state = UnitState::kCreated;
+                std::int64_t count = 0;
+            };
+
+            auto Load(std::memory_order order = std::memory_order_acquire) const noexcept
+                -> Snapshot {
+                return Unpack(m_word.load(order));
+            }
+
+            auto State() const noexcept -> UnitState { return Load().state; }
+
+            /// One CAS; the counter is left as it is.
+            auto TryTransition(UnitState from, UnitState to) noexcept -> bool {
+                if (!IsTransitionAllowed(from, to)) {
+                    return false;
+                }
+                auto word = m_word.load(std::memory_order_relaxed);
+                while (Unpack(word).state == from) {
+                    if (m_word.compare_exchange_weak(word, WithState(word, to),
+                                                     std::memory_order_acq_rel,
+                                                     std::memory_order_relaxed)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            /**
+             * CAS loop applying `fn(Snapshot &) -> bool` to the current
+             * state and count. Nothing is stored if fn returns false or
+             * picks a transition the table forbids. `fn` may run several
+             * times and must not have side effects beyond its argument.
+             */
+            template <typename F>
+            auto Update(F &&fn, Snapshot *before = nullptr) noexcept -> bool {
+                auto word = m_word.load(std::memory_order_relaxed);
+                while (true) {
+                    auto current = Unpack(word);
+                    auto next = current;
+                    if (!fn(next) || !IsTransitionAllowed(current.state, next.state)) {
+                        return false;
+                    }
+                    if (m_word.compare_exchange_weak(word, Pack(next),
+                                                     std::memory_order_acq_rel,
+                                                     std::memory_order_relaxed)) {
+                        if (before != nullptr) {
+                            *before = current;
+                        }
+                        return true;
+                    }
+                }
+            }
+
+        private:
+            static constexpr unsigned kStateBits = 3;
+            static constexpr std::uint64_t kStateMask = (1U << kStateBits) - 1;
+
+            static auto Pack(Snapshot s) noexcept -> std::uint64_t {
+                return (static_cast<std::uint64_t>(s.count) << kStateBits) |
+                       static_cast<std::uint64_t>(s.state);
+            }
+
+            static auto Unpack(std::uint64_t word) noexcept -> Snapshot {
+                return {static_cast<UnitState>(word & kStateMask),
+                        static_cast<std::int64_t>(word) >> kStateBits};
+            }
+
+            static auto WithState(std::uint64_t word, UnitState state) noexcept
+                -> std::uint64_t {
+                return (word & ~kStateMask) | static_cast<std::uint64_t>(state);
+            }
+
+            std::atomic<std::uint64_t> m_word{0};
+        };
+    } // namespace eng
+} // namespace ic
+
 namespace ic {    
     namespace eng {
-        class IWorkUnit {
+        /**
+         * Units embed their mailbox link (utils::MpscNode), so posting one
+         * to a worker or actor is a single atomic exchange.
+         */
+        class IWorkUnit : public utils::MpscNode {
         private:
-            std::unique_ptr<IWorkUnit> m_self_unique_ptr =
-                std::make_unique<IWorkUnit>();
+            std::unique_ptr<IWorkUnit> m_self_unique_ptr{};
+            UnitLifecycle m_lifecycle{};
 
         public:
             IWorkUnit() {};
@@ -490,6 +765,49 @@ namespace ic {
             std::unique_ptr<IWorkUnit>&& GetUniquePtr() {
                 return std::move(m_self_unique_ptr);
             }
+
+            auto Lifecycle() noexcept -> UnitLifecycle & { return m_lifecycle; }
+            auto Lifecycle() const noexcept -> const UnitLifecycle & {
+                return m_lifecycle;
+            }
+        };
+    } // namespace eng
+} // namespace ic
+
+namespace ic {
+    namespace eng {
+        /**
+         * Intrusive MPSC mailbox of work units: many threads post, one
+         * thread (the owning worker or actor) takes.
+         *
+         * Owns the units it holds; the ones left over are destroyed with
+         * the mailbox.
+         */
+        class Mailbox {
+        public:
+            Mailbox() = default;
+            Mailbox(const Mailbox &) = delete;
+            auto operator=(const Mailbox &) -> Mailbox & = delete;
+
+            ~Mailbox() {
+                while (TryTake() != nullptr) {
+                }
+            }
+
+            /// Wait-free, no allocation; callable from any thread.
+            void Post(std::unique_ptr<IWorkUnit> unit) noexcept {
+                m_queue.Push(unit.release());
+            }
+
+            /// Owning thread only; nullptr if nothing is (fully) posted yet.
+            auto TryTake() noexcept -> std::unique_ptr<IWorkUnit> {
+                return std::unique_ptr<IWorkUnit>(m_queue.TryPop());
+            }
+
+            auto Empty() const noexcept -> bool { return m_queue.Empty(); }
+
+        private:
+            utils::IntrusiveMpscQueue<IWorkUnit> m_queue{};
         };
     } // namespace eng
 } // namespace ic
@@ -518,6 +836,21 @@ namespace ic {
 } // namespace ic
 
 
+namespace ic {
+    namespace eng {
+        /**
+         * Bytes reserved inline for each contract in a work unit's
+         * participant lists; larger contracts spill to the heap. Defaults
+         * to sizeof(IContractType), so implementations that add no members
+         * to the interface fit inline. Specialize it for interfaces whose
+         * implementations add members.
+         */
+        template <typename IContractType> struct ContractInlineSize {
+            static constexpr std::size_t value = sizeof(IContractType);
+        };
+    } // namespace eng
+} // namespace ic
+
 namespace ic {
     namespace eng {        
         template <typename DerivedType, typename IContractType, typename IWorkUnitType, typename MutexType>
@@ -527,7 +860,10 @@ namespace ic {
         private:
             using ParticipantType = ic::eng::ParticipantsType;
             using WorkUnitTPtr = std::unique_ptr<IWorkUnitType>;
-            using ContractTPtr = std::unique_ptr<IContractType>;
+            // Contracts up to this size sit inline in the participant list
+            static constexpr std::size_t kContractInlineSize =
+                ContractInlineSize<IContractType>::value;
+            using ContractTPtr = utils::InlinePoly<IContractType, kContractInlineSize>;
             using ParticipantContractPair = std::pair<ParticipantType, ContractTPtr>;
             using ParticipantContractPairList = std::vector<ParticipantContractPair>;
             using ParticipantsMap = std::unordered_map<ParticipantType, ParticipantContractPairList>;
@@ -550,7 +886,7 @@ namespace ic {
 namespace ic {
     namespace eng {
         template <typename IContract, typename IWorkUnit>
-        class Contract: public WorkUnit<Contract, IContract, IWorkUnit, std::mutex> {
+        class Contract: public WorkUnit<Contract<IContract, IWorkUnit>, IContract, IWorkUnit, utils::CompactMutex> {
             
         private: 
 
@@ -560,12 +896,1610 @@ namespace ic {
     } // namespace eng
 } // namespace ic
 
+namespace ic {
+    namespace eng {
+        /**
+         * Move-only `void()` callable stored inline, in the spirit of
+         * utils::FastPimpl: no allocation, and a callable larger than
+         * Capacity is a compile error showing its actual size.
+         */
+        template <std::size_t Capacity> class InlineTask {
+        public:
+            InlineTask() noexcept = default;
+
+            template <typename F, typename Fn = std::decay_t<F>,
+                      typename = std::enable_if_t<!std::is_same_v<Fn, InlineTask>>>
+            // NOLINTNEXTLINE(google-explicit-constructor)
+            InlineTask(F &&fn) noexcept(std::is_nothrow_constructible_v<Fn, F>) {
+                Validate<sizeof(Fn), alignof(Fn)>();
+                static_assert(std::is_invocable_v<Fn &>, "task must be callable as f()");
+                static_assert(std::is_nothrow_move_constructible_v<Fn>,
+                              "task must be nothrow move constructible");
+                ::new (static_cast<void *>(m_storage)) Fn(std::forward<F>(fn));
+                m_ops = &kOps<Fn>;
+            }
+
+            InlineTask(InlineTask &&other) noexcept { MoveFrom(other); }
+
+            auto operator=(InlineTask &&other) noexcept -> InlineTask & {
+                if (this != &other) {
+                    Reset();
+                    MoveFrom(other);
+                }
+                return *this;
+            }
+
+            InlineTask(const InlineTask &) = delete;
+            auto operator=(const InlineTask &) -> InlineTask & = delete;
+
+            ~InlineTask() { Reset(); }
+
+            explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+            /// Must not be called on an empty task.
+            void operator()() { m_ops->invoke(m_storage); }
+
+            void Reset() noexcept {
+                if (m_ops != nullptr) {
+                    m_ops->destroy(m_storage);
+                    m_ops = nullptr;
+                }
+            }
+
+        private:
+            struct Ops {
+                void (*invoke)(void *);
+                void (*move)(void *dst, void *src) noexcept;
+                void (*destroy)(void *) noexcept;
+            };
+
+            template <typename Fn>
+            static constexpr Ops kOps = {
+                [](void *self) { (*static_cast<Fn *>(self))(); },
+                [](void *dst, void *src) noexcept {
+                    ::new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+                    static_cast<Fn *>(src)->~Fn();
+                },
+                [](void *self) noexcept { static_cast<Fn *>(self)->~Fn(); },
+            };
+
+            // A template, as in FastPimpl, so the sizes show in the error
+            template <std::size_t ActualSize, std::size_t ActualAlignment>
+            static constexpr void Validate() noexcept {
+                static_assert(Capacity >= ActualSize,
+                              "task does not fit: Capacity >= sizeof(F) failed");
+                static_assert(alignof(std::max_align_t) % ActualAlignment == 0,
+                              "task is over-aligned: alignof(F) > alignof(std::max_align_t)");
+            }
+
+            void MoveFrom(InlineTask &other) noexcept {
+                if (other.m_ops != nullptr) {
+                    other.m_ops->move(m_storage, other.m_storage);
+                    m_ops = std::exchange(other.m_ops, nullptr);
+                }
+            }
+
+            alignas(std::max_align_t) std::byte m_storage[Capacity];
+            const Ops *m_ops = nullptr;
+        };
+
+        class ActorCell;
+
+        struct ExecutorOptions {
+            /// Most workers running at once (blocked ones aside), 0 for one
+            /// per hardware thread
+            std::size_t workers = 0;
+            /// Fewest running workers the autoscaler shrinks to
+            std::size_t min_workers = 1;
+            /// Messages an actor handles per turn before it yields its worker
+            std::size_t batch = 64;
+            /// Empty polls of the run queue before a worker parks
+            std::uint32_t spin_count = 10000;
+            /// Tasks the task queue holds before it has to allocate
+            std::size_t task_capacity = 1024;
+            /// Cap on workers including compensating ones, 0 for 4 * workers
+            std::size_t max_workers = 0;
+            /// A turn running longer than this counts as blocking (see
+            /// Executor::BlockingScope); zero disables the detection
+            std::chrono::milliseconds blocking_threshold{50};
+            /// How long a surplus compensating worker stays parked before it
+            /// retires
+            std::chrono::milliseconds keep_alive{200};
+            /// Autoscaler period; zero keeps `workers` running all the time
+            std::chrono::milliseconds scale_interval{10};
+            /// Estimated queueing delay above which a worker is added
+            std::chrono::microseconds target_queue_delay{1000};
+            /// Smoothed busy share of the running workers' time below which
+            /// one is parked
+            double low_utilization = 0.5;
+        };
+
+        struct ResourceGroupOptions {
+            /// Turns the group gets per visit of the scheduler, relative to
+            /// other groups
+            std::uint32_t weight = 1;
+            /// Most workers running the group's units at once, 0 for no cap
+            std::size_t max_workers = 0;
+            /// Tasks the group's task queue holds before it has to allocate
+            std::size_t task_capacity = 256;
+        };
+
+        /// Snapshot of Executor's scaling state, see Executor::Metrics().
+        struct ExecutorMetrics {
+            /// Workers the autoscaler wants running
+            std::size_t target_workers = 0;
+            /// Worker threads, whether running, blocked or parked in reserve
+            std::size_t live_workers = 0;
+            std::size_t reserved_workers = 0;
+            std::size_t blocked_workers = 0;
+            /// Last estimate: queued work divided by turn throughput
+            std::chrono::nanoseconds queue_delay{0};
+            /// Smoothed busy share of the target workers' time
+            double utilization = 0;
+            std::uint64_t scale_ups = 0;
+            std::uint64_t scale_downs = 0;
+            /// Threads started to stand in for blocked workers, and retired
+            std::uint64_t spawned = 0;
+            std::uint64_t retired = 0;
+        };
+
+        /**
+         * Worker pool running actors that have pending messages.
+         *
+         * Actors are queued on a shared run queue only while they have
+         * messages, and submitted tasks on a queue of their own; idle
+         * workers spin briefly, then park.
+         *
+         * A monitor thread sizes the running set. Every scale_interval it
+         * estimates queueing delay (queued items over turns completed) and
+         * utilization (busy time over running time). Workers read the
+         * clock only when they switch between busy and idle, so back-to-back
+         * turns pay nothing for it. The target grows by half while delay
+         * exceeds target_queue_delay and shrinks by one while utilization
+         * stays low. Workers above the target park in a reserve and are
+         * the first to be woken when it grows again.
+         *
+         * Workers blocked in a syscall do not count towards the target:
+         * while some are (per BlockingScope, or because the monitor saw a
+         * turn exceed blocking_threshold), reserve workers are woken or new
+         * ones started, up to max_workers. Once the blocking ends, workers
+         * beyond ExecutorOptions::workers retire after keep_alive in
+         * reserve.
+         */
+        class Executor {
+        public:
+            /// Room for a lambda capturing six pointers; a task is then one
+            /// cache line
+            static constexpr std::size_t kTaskCapacity = 48;
+            using Task = InlineTask<kTaskCapacity>;
+
+            explicit Executor(ExecutorOptions options = {});
+            /// Runs everything still queued, including what it submits
+            /// meanwhile, then stops the workers. Other threads must have
+            /// stopped submitting and telling actors.
+            ~Executor();
+
+            Executor(const Executor &) = delete;
+            auto operator=(const Executor &) -> Executor & = delete;
+
+            /**
+             * A tenant's share of the executor: its own run queues, a
+             * weight and an optional cap on concurrently running workers.
+             *
+             * Workers take groups from a shared ring of tokens and run up
+             * to `weight` turns of a group per token (deficit round robin
+             * with the weight as quantum), so a dispatch costs O(1) however
+             * many groups there are. A group holds at most one token per
+             * worker it may use -- its own max_workers, else
+             * ExecutorOptions::max_workers, so that compensating workers
+             * find work -- and no more idle tokens than it has queued
+             * items. Backlogged groups therefore share turns in
+             * proportion to their weights (a capped group gets at most its
+             * cap's worth of tokens), a tenant's backlog cannot lengthen
+             * the ring for others, and a lone busy group still gets every
+             * worker.
+             */
+            class ResourceGroup {
+            public:
+                ResourceGroup(const ResourceGroup &) = delete;
+                auto operator=(const ResourceGroup &) -> ResourceGroup & = delete;
+
+                auto Weight() const noexcept -> std::uint32_t { return m_weight; }
+                auto MaxWorkers() const noexcept -> std::size_t { return m_tokens_limit; }
+
+                /// Queued actors and tasks.
+                auto Pending() const noexcept -> std::int64_t {
+                    return m_pending.load(std::memory_order_relaxed);
+                }
+
+                /// Turns run so far.
+                auto Dispatched() const noexcept -> std::uint64_t {
+                    return m_dispatched.load(std::memory_order_relaxed);
+                }
+
+            private:
+                friend class Executor;
+
+                ResourceGroup(const ResourceGroupOptions &options, std::size_t max_workers)
+                    : m_weight(std::max<std::uint32_t>(1, options.weight)),
+                      m_tokens_limit(options.max_workers == 0
+                                         ? max_workers
+                                         : std::min(options.max_workers, max_workers)),
+                      m_tasks(options.task_capacity) {}
+
+                std::uint32_t m_weight;
+                std::size_t m_tokens_limit;
+                moodycamel::ConcurrentQueue<ActorCell *> m_actors{};
+                moodycamel::ConcurrentQueue<Task> m_tasks;
+                // Items queued, tokens in the ring or held by workers, and
+                // tokens held by workers (which may be blocked for long)
+                std::atomic<std::int64_t> m_pending{0};
+                std::atomic<std::size_t> m_tokens{0};
+                std::atomic<std::size_t> m_active{0};
+                std::atomic<std::uint64_t> m_dispatched{0};
+            };
+
+            /// Groups live as long as the executor.
+            auto CreateGroup(const ResourceGroupOptions &options) -> ResourceGroup &;
+
+            /// Where units and tasks without a group go: weight 1, no cap.
+            auto DefaultGroup() noexcept -> ResourceGroup & { return *m_default_group; }
+
+            /// Queues an actor for one turn in its group; see ActorCell::Tell.
+            void Schedule(ActorCell *actor);
+
+            /**
+             * Runs `task` once on a worker, before the executor is
+             * destroyed; it must not throw. Does not allocate while the
+             * group's task queue has room (see
+             * ResourceGroupOptions::task_capacity).
+             */
+            auto Submit(Task task) -> bool { return Submit(DefaultGroup(), std::move(task)); }
+            auto Submit(ResourceGroup &group, Task task) -> bool;
+
+            /**
+             * Marks the current worker as blocked for the guard's lifetime,
+             * letting the executor start a compensating worker. Wrap
+             * blocking calls in handlers with it; on threads that are not
+             * workers it does nothing. Nests.
+             */
+            class BlockingScope {
+            public:
+                BlockingScope() noexcept;
+                ~BlockingScope();
+
+                BlockingScope(const BlockingScope &) = delete;
+                auto operator=(const BlockingScope &) -> BlockingScope & = delete;
+
+            private:
+                Executor *m_executor;
+            };
+
+            /// Live worker threads, compensating ones included.
+            auto WorkerCount() const noexcept -> std::size_t {
+                return m_live.load(std::memory_order_relaxed);
+            }
+
+            auto Metrics() const noexcept -> ExecutorMetrics;
+
+        private:
+            enum : std::uint8_t { kBlockingScope = 1, kBlockingDetected = 2 };
+
+            struct WorkerSlot {
+                std::thread thread{};
+                bool used = false;                      // under m_spawn_mutex
+                std::atomic<bool> exited{false};
+                std::atomic<std::uint64_t> turn{0};     // odd while in a turn
+                std::atomic<std::uint8_t> blocking{0};
+                // Busy streaks: finished ones summed, and the start of the
+                // current one (0 while idle), in steady_clock nanoseconds
+                std::atomic<std::int64_t> busy_ns{0};
+                std::atomic<std::int64_t> busy_since{0};
+                std::uint64_t seen_turn = 0;            // monitor only
+                std::chrono::steady_clock::time_point seen_at{};
+                std::uint32_t scope_depth = 0;          // owner only
+            };
+
+            struct CurrentWorker {
+                Executor *executor = nullptr;
+                WorkerSlot *slot = nullptr;
+            };
+
+            static auto Current() noexcept -> CurrentWorker & {
+                thread_local CurrentWorker current;
+                return current;
+            }
+
+            void WorkerLoop(WorkerSlot &slot);
+            void RunQuantum(ResourceGroup &group, WorkerSlot &slot, Task &task);
+            void AddWork(ResourceGroup &group);
+            void IssueTokens(ResourceGroup &group);
+            auto Queued() -> std::size_t;
+            void MonitorLoop();
+            void Autoscale(std::chrono::nanoseconds elapsed,
+                           std::uint64_t completed, std::int64_t busy_ns);
+
+            static auto NowNs() noexcept -> std::int64_t {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+            }
+            void Run(ActorCell *actor);
+            void WakeOne();
+            void Spawn();
+            void MaybeCompensate();
+            auto Running() const noexcept -> std::size_t;
+            auto Desired() const noexcept -> std::size_t;
+            auto Reserve() -> bool;
+            void SetBlocking(WorkerSlot &slot, std::uint8_t flag);
+            void ClearBlocking(WorkerSlot &slot, std::uint8_t flag);
+
+            static void BeginTurn(WorkerSlot &slot) noexcept {
+                slot.turn.store(slot.turn.load(std::memory_order_relaxed) + 1,
+                                std::memory_order_relaxed);
+            }
+
+            // Store-then-load against the monitor's fetch_or-then-load, both
+            // seq_cst: at least one side sees the other, so a detected flag
+            // is never left behind once the turn is over
+            void EndTurn(WorkerSlot &slot) {
+                slot.turn.store(slot.turn.load(std::memory_order_relaxed) + 1,
+                                std::memory_order_seq_cst);
+                if ((slot.blocking.load(std::memory_order_seq_cst) &
+                     kBlockingDetected) != 0) {
+                    ClearBlocking(slot, kBlockingDetected);
+                }
+            }
+
+            ExecutorOptions m_options;
+            // One entry per token; see ResourceGroup
+            moodycamel::ConcurrentQueue<ResourceGroup *> m_ring{};
+            std::mutex m_groups_mutex{};
+            std::vector<std::unique_ptr<ResourceGroup>> m_groups{};
+            ResourceGroup *m_default_group = nullptr;
+            std::mutex m_park_mutex{};
+            std::condition_variable m_park_cv{};
+            std::condition_variable m_monitor_cv{};
+            std::atomic<std::size_t> m_parked{0};
+            std::atomic<bool> m_stop{false};
+            // Workers started and not retired, how many of them block, and
+            // how many are parked in reserve (changed under m_park_mutex)
+            std::atomic<std::size_t> m_live{0};
+            std::atomic<std::size_t> m_blocked{0};
+            std::atomic<std::size_t> m_reserved{0};
+            std::atomic<std::size_t> m_target{0};
+            std::condition_variable m_reserve_cv{};
+            std::mutex m_spawn_mutex{};
+            std::unique_ptr<WorkerSlot[]> m_slots;
+            std::thread m_monitor{};
+
+            // Written by the monitor, read by Metrics()
+            std::atomic<std::int64_t> m_queue_delay_ns{0};
+            std::atomic<double> m_utilization{0};
+            std::atomic<std::uint64_t> m_scale_ups{0};
+            std::atomic<std::uint64_t> m_scale_downs{0};
+            std::atomic<std::uint64_t> m_spawned{0};
+            std::atomic<std::uint64_t> m_retired{0};
+            int m_shrink_cooldown = 0; // monitor only
+        };
+
+        /**
+         * Actor mode of a unit: a mailbox drained by at most one executor
+         * worker at a time, so message handlers need no lock.
+         *
+         * The actor is scheduled only on the message that finds it idle and
+         * keeps its worker for up to ExecutorOptions::batch messages; an
+         * idle actor costs its memory and nothing else. Destroy it once
+         * TryCancel() has succeeded, or after the executor.
+         */
+        class ActorCell {
+        public:
+            virtual ~ActorCell() = default;
+
+            /**
+             * Any thread. Lock-free, and only the message that finds the
+             * actor idle queues it. Messages told to a cancelled actor are
+             * destroyed with it, unhandled.
+             */
+            void Tell(std::unique_ptr<IWorkUnit> message) {
+                m_mailbox.Post(std::move(message));
+                bool wake = false;
+                if (m_lifecycle.Update([&wake](UnitLifecycle::Snapshot &s) {
+                        wake = ++s.count == 1 && s.state != UnitState::kRunning;
+                        if (wake) {
+                            s.state = UnitState::kQueued;
+                        }
+                        return true;
+                    }) &&
+                    wake) {
+                    m_executor.Schedule(this);
+                }
+            }
+
+            auto Group() const noexcept -> Executor::ResourceGroup & { return m_group; }
+
+            /**
+             * Retires an idle actor: not running, not queued, and with no
+             * message counted or in the middle of a Tell (a non-zero
+             * count), so it will never run again. Fails otherwise.
+             * Callers must have stopped telling the actor before
+             * destroying it: a Tell may post and then touch the actor.
+             */
+            auto TryCancel() noexcept -> bool {
+                return m_lifecycle.Update([](UnitLifecycle::Snapshot &s) {
+                    if (s.count != 0 || (s.state != UnitState::kCreated &&
+                                         s.state != UnitState::kWaiting)) {
+                        return false;
+                    }
+                    s.state = UnitState::kCancelled;
+                    return true;
+                });
+            }
+
+            auto State() const noexcept -> UnitState { return m_lifecycle.State(); }
+
+        protected:
+            ActorCell(Executor &executor, UnitLifecycle &lifecycle,
+                      Executor::ResourceGroup *group = nullptr) noexcept
+                : m_lifecycle(lifecycle), m_executor(executor),
+                  m_group(group != nullptr ? *group : executor.DefaultGroup()) {}
+
+            Mailbox m_mailbox{};
+
+        private:
+            friend class Executor;
+
+            /// Handles up to `budget` messages and returns how many.
+            virtual auto RunBatch(std::size_t budget) -> std::size_t = 0;
+
+            // The count is messages posted and not yet handled; the actor is
+            // queued or running exactly while it is positive. It can dip
+            // below zero when a batch picks up a message whose Tell has not
+            // counted it yet.
+            UnitLifecycle &m_lifecycle;
+            Executor &m_executor;
+            Executor::ResourceGroup &m_group;
+        };
+
+        /**
+         * @tparam DerivedType provides `void Receive(std::unique_ptr<IWorkUnit>)`,
+         * called on an executor worker; it must not throw.
+         */
+        template <typename DerivedType> class Actor : public ActorCell {
+        protected:
+            using ActorCell::ActorCell;
+
+        private:
+            auto RunBatch(std::size_t budget) -> std::size_t final {
+                std::size_t handled = 0;
+                while (handled != budget) {
+                    auto message = m_mailbox.TryTake();
+                    if (!message) {
+                        break;
+                    }
+                    static_cast<DerivedType *>(this)->Receive(
+                        std::move(message));
+                    ++handled;
+                }
+                return handled;
+            }
+        };
+
+        /// Lock type of units in actor mode, which run single-threaded.
+        struct NullMutex {
+            void lock() noexcept {}
+            auto try_lock() noexcept -> bool { return true; }
+            void unlock() noexcept {}
+        };
+
+        /**
+         * A WorkUnit in actor mode: its state is only touched by Receive,
+         * one message at a time, so no mutex is taken on the hot path.
+         */
+        template <typename DerivedType, typename IContractType,
+                  typename IWorkUnitType>
+        class ActorWorkUnit
+            : public WorkUnit<DerivedType, IContractType, IWorkUnitType,
+                              NullMutex>,
+              public Actor<DerivedType> {
+        public:
+            explicit ActorWorkUnit(Executor &executor,
+                                   Executor::ResourceGroup *group = nullptr)
+                : Actor<DerivedType>(executor, this->Lifecycle(), group) {}
+        };
+
+        inline Executor::Executor(ExecutorOptions options)
+            : m_options(options) {
+            if (m_options.workers == 0) {
+                m_options.workers =
+                    std::max(1U, std::thread::hardware_concurrency());
+            }
+            if (m_options.batch == 0) {
+                m_options.batch = 1;
+            }
+            if (m_options.max_workers == 0) {
+                m_options.max_workers = 4 * m_options.workers;
+            }
+            m_options.max_workers =
+                std::max(m_options.max_workers, m_options.workers);
+            m_options.min_workers =
+                std::clamp<std::size_t>(m_options.min_workers, 1, m_options.workers);
+            m_target.store(m_options.workers, std::memory_order_relaxed);
+            ResourceGroupOptions defaults;
+            defaults.task_capacity = m_options.task_capacity;
+            m_default_group = &CreateGroup(defaults);
+            m_slots = std::make_unique<WorkerSlot[]>(m_options.max_workers);
+            for (std::size_t i = 0; i != m_options.workers; ++i) {
+                m_live.fetch_add(1, std::memory_order_relaxed);
+                Spawn();
+            }
+            if (m_options.blocking_threshold.count() > 0 ||
+                m_options.scale_interval.count() > 0) {
+                m_monitor = std::thread([this] { MonitorLoop(); });
+            }
+        }
+
+        inline Executor::~Executor() {
+            {
+                std::lock_guard<std::mutex> spawn_lock(m_spawn_mutex);
+                std::lock_guard<std::mutex> lock(m_park_mutex);
+                m_stop.store(true, std::memory_order_relaxed);
+            }
+            m_park_cv.notify_all();
+            m_reserve_cv.notify_all();
+            m_monitor_cv.notify_all();
+            if (m_monitor.joinable()) {
+                m_monitor.join();
+            }
+            // No slot is taken once m_stop is set, so no lock is needed
+            for (std::size_t i = 0; i != m_options.max_workers; ++i) {
+                if (m_slots[i].thread.joinable()) {
+                    m_slots[i].thread.join();
+                }
+            }
+        }
+
+        inline Executor::BlockingScope::BlockingScope() noexcept
+            : m_executor(Current().executor) {
+            if (m_executor != nullptr && Current().slot->scope_depth++ == 0) {
+                m_executor->SetBlocking(*Current().slot, kBlockingScope);
+            }
+        }
+
+        inline Executor::BlockingScope::~BlockingScope() {
+            if (m_executor != nullptr && --Current().slot->scope_depth == 0) {
+                m_executor->ClearBlocking(*Current().slot, kBlockingScope);
+            }
+        }
+
+        inline void Executor::SetBlocking(WorkerSlot &slot, std::uint8_t flag) {
+            if (slot.blocking.fetch_or(flag, std::memory_order_relaxed) == 0) {
+                m_blocked.fetch_add(1, std::memory_order_relaxed);
+                MaybeCompensate();
+            }
+        }
+
+        // The worker and the monitor may both clear kBlockingDetected; only
+        // the one that actually clears the last flag gives the count back.
+        // Compensating workers parked meanwhile become surplus: wake them so
+        // they go to reserve and retire after keep_alive
+        inline void Executor::ClearBlocking(WorkerSlot &slot, std::uint8_t flag) {
+            if (slot.blocking.fetch_and(static_cast<std::uint8_t>(~flag),
+                                        std::memory_order_relaxed) != flag) {
+                return;
+            }
+            m_blocked.fetch_sub(1, std::memory_order_relaxed);
+            if (Running() > Desired()) {
+                std::lock_guard<std::mutex> lock(m_park_mutex);
+                m_park_cv.notify_all();
+            }
+        }
+
+        inline auto Executor::Running() const noexcept -> std::size_t {
+            return m_live.load(std::memory_order_relaxed) -
+                   m_reserved.load(std::memory_order_relaxed);
+        }
+
+        inline auto Executor::Desired() const noexcept -> std::size_t {
+            return m_target.load(std::memory_order_relaxed) +
+                   m_blocked.load(std::memory_order_relaxed);
+        }
+
+        // Wakes reserve workers first; starts threads only when none are left
+        inline void Executor::MaybeCompensate() {
+            if (Running() >= Desired() || m_stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (m_reserved.load(std::memory_order_relaxed) != 0) {
+                std::lock_guard<std::mutex> lock(m_park_mutex);
+                m_reserve_cv.notify_all();
+                return;
+            }
+            auto live = m_live.load(std::memory_order_relaxed);
+            while (live < m_options.max_workers &&
+                   live < Desired() + m_reserved.load(std::memory_order_relaxed) &&
+                   !m_stop.load(std::memory_order_relaxed)) {
+                if (m_live.compare_exchange_weak(live, live + 1,
+                                                 std::memory_order_relaxed)) {
+                    m_spawned.fetch_add(1, std::memory_order_relaxed);
+                    Spawn();
+                    live = m_live.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // The caller has already counted the new worker in m_live
+        inline void Executor::Spawn() {
+            std::lock_guard<std::mutex> lock(m_spawn_mutex);
+            if (m_stop.load(std::memory_order_relaxed)) {
+                m_live.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+            // m_live never exceeds max_workers, so a slot is free or exited
+            for (std::size_t i = 0; i != m_options.max_workers; ++i) {
+                auto &slot = m_slots[i];
+                if (slot.used && !slot.exited.load(std::memory_order_acquire)) {
+                    continue;
+                }
+                if (slot.thread.joinable()) {
+                    slot.thread.join();
+                }
+                slot.used = true;
+                slot.exited.store(false, std::memory_order_relaxed);
+                // A flag the previous thread left behind still counts
+                if (slot.blocking.exchange(0, std::memory_order_relaxed) != 0) {
+                    m_blocked.fetch_sub(1, std::memory_order_relaxed);
+                }
+                slot.seen_turn = slot.turn.load(std::memory_order_relaxed);
+                slot.thread = std::thread([this, &slot] { WorkerLoop(slot); });
+                return;
+            }
+            m_live.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // Parks the calling worker while more are running than wanted.
+        // Returns false if it retired instead: a worker beyond
+        // ExecutorOptions::workers that stayed in reserve for keep_alive
+        inline auto Executor::Reserve() -> bool {
+            std::unique_lock<std::mutex> lock(m_park_mutex);
+            if (Running() <= Desired() || m_stop.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            m_reserved.fetch_add(1, std::memory_order_relaxed);
+            // This worker may have been woken for work it will not do now
+            if (m_parked.load(std::memory_order_relaxed) != 0 &&
+                m_ring.size_approx() != 0) {
+                m_park_cv.notify_one();
+            }
+            auto wanted = [this] {
+                // This worker is in m_reserved; leaving makes Running() + 1
+                return m_stop.load(std::memory_order_relaxed) ||
+                       Running() < Desired();
+            };
+            while (!m_reserve_cv.wait_for(lock, m_options.keep_alive, wanted)) {
+                if (m_live.load(std::memory_order_relaxed) >
+                    m_options.workers + m_blocked.load(std::memory_order_relaxed)) {
+                    m_reserved.fetch_sub(1, std::memory_order_relaxed);
+                    m_live.fetch_sub(1, std::memory_order_relaxed);
+                    m_retired.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            m_reserved.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        inline auto Executor::Metrics() const noexcept -> ExecutorMetrics {
+            ExecutorMetrics metrics;
+            metrics.target_workers = m_target.load(std::memory_order_relaxed);
+            metrics.live_workers = m_live.load(std::memory_order_relaxed);
+            metrics.reserved_workers = m_reserved.load(std::memory_order_relaxed);
+            metrics.blocked_workers = m_blocked.load(std::memory_order_relaxed);
+            metrics.queue_delay = std::chrono::nanoseconds(
+                m_queue_delay_ns.load(std::memory_order_relaxed));
+            metrics.utilization = m_utilization.load(std::memory_order_relaxed);
+            metrics.scale_ups = m_scale_ups.load(std::memory_order_relaxed);
+            metrics.scale_downs = m_scale_downs.load(std::memory_order_relaxed);
+            metrics.spawned = m_spawned.load(std::memory_order_relaxed);
+            metrics.retired = m_retired.load(std::memory_order_relaxed);
+            return metrics;
+        }
+
+        inline void Executor::MonitorLoop() {
+            using Clock = std::chrono::steady_clock;
+            auto threshold = m_options.blocking_threshold;
+            auto interval = m_options.scale_interval;
+            auto tick = interval.count() == 0 ? threshold
+                        : threshold.count() == 0 ? interval
+                                                 : std::min(threshold, interval);
+            auto last = Clock::now();
+            std::uint64_t last_turns = 0;
+            std::int64_t last_busy = 0;
+            std::unique_lock<std::mutex> lock(m_park_mutex);
+            while (!m_monitor_cv.wait_for(lock, tick, [this] {
+                return m_stop.load(std::memory_order_relaxed);
+            })) {
+                lock.unlock();
+                auto now = Clock::now();
+                auto now_ns = NowNs();
+                std::uint64_t turns = 0;
+                std::int64_t busy = 0;
+                {
+                    std::lock_guard<std::mutex> spawn_lock(m_spawn_mutex);
+                    for (std::size_t i = 0; i != m_options.max_workers; ++i) {
+                        auto &slot = m_slots[i];
+                        auto turn = slot.turn.load(std::memory_order_relaxed);
+                        // Slots keep their counters across threads, so the
+                        // sums only grow
+                        turns += turn / 2;
+                        busy += slot.busy_ns.load(std::memory_order_relaxed);
+                        auto since = slot.busy_since.load(std::memory_order_relaxed);
+                        if (since != 0 && since < now_ns) {
+                            busy += now_ns - since;
+                        }
+                        if (!slot.used || slot.exited.load(std::memory_order_relaxed)) {
+                            continue;
+                        }
+                        auto blocking = slot.blocking.load(std::memory_order_relaxed);
+                        if (turn != slot.seen_turn) {
+                            slot.seen_turn = turn;
+                            slot.seen_at = now;
+                            continue;
+                        }
+                        if (threshold.count() == 0 || (turn & 1) == 0 ||
+                            (blocking & kBlockingDetected) != 0 ||
+                            now - slot.seen_at < threshold) {
+                            continue;
+                        }
+                        if (slot.blocking.fetch_or(kBlockingDetected,
+                                                   std::memory_order_seq_cst) == 0) {
+                            m_blocked.fetch_add(1, std::memory_order_relaxed);
+                        }
+                        // The turn may have ended meanwhile, missing the flag;
+                        // see EndTurn
+                        if (slot.turn.load(std::memory_order_seq_cst) != turn) {
+                            ClearBlocking(slot, kBlockingDetected);
+                        }
+                    }
+                }
+                if (interval.count() != 0 && now - last >= interval) {
+                    // The two busy reads race with a streak ending; never
+                    // let that show as negative time
+                    Autoscale(now - last, turns - last_turns,
+                              std::max<std::int64_t>(0, busy - last_busy));
+                    last = now;
+                    last_turns = turns;
+                    last_busy = std::max(busy, last_busy);
+                }
+                // Outside m_spawn_mutex, which Spawn takes
+                MaybeCompensate();
+                lock.lock();
+            }
+        }
+
+        inline void Executor::Autoscale(std::chrono::nanoseconds elapsed,
+                                        std::uint64_t completed, std::int64_t busy_ns) {
+            constexpr double kSmoothing = 0.3;
+            // Ticks to hold off shrinking again, while utilization catches up
+            constexpr int kShrinkCooldown = 5;
+            static_assert(kShrinkCooldown > 0);
+
+            auto queued = Queued();
+            // Little's law; with nothing completed, queued work has waited
+            // at least the whole interval
+            auto delay = completed != 0
+                             ? elapsed * static_cast<std::int64_t>(queued) /
+                                   static_cast<std::int64_t>(completed)
+                             : (queued != 0 ? elapsed : std::chrono::nanoseconds(0));
+            m_queue_delay_ns.store(delay.count(), std::memory_order_relaxed);
+
+            auto target = m_target.load(std::memory_order_relaxed);
+            // Blocked workers count as busy too; cap the sample so they do
+            // not hold the average up for long
+            auto sample = std::min(1.0, static_cast<double>(busy_ns) /
+                                            (static_cast<double>(elapsed.count()) *
+                                             static_cast<double>(target)));
+            auto utilization = kSmoothing * sample +
+                               (1 - kSmoothing) *
+                                   m_utilization.load(std::memory_order_relaxed);
+            m_utilization.store(utilization, std::memory_order_relaxed);
+
+            if (m_shrink_cooldown > 0) {
+                --m_shrink_cooldown;
+            }
+            if (delay > m_options.target_queue_delay) {
+                if (target < m_options.workers) {
+                    // Grow fast, shrink slowly: a backlog costs latency now
+                    target = std::min(m_options.workers,
+                                      target + std::max<std::size_t>(1, target / 2));
+                    m_target.store(target, std::memory_order_relaxed);
+                    m_scale_ups.fetch_add(1, std::memory_order_relaxed);
+                }
+            } else if (utilization < m_options.low_utilization &&
+                       target > m_options.min_workers && m_shrink_cooldown == 0) {
+                m_target.store(target - 1, std::memory_order_relaxed);
+                m_scale_downs.fetch_add(1, std::memory_order_relaxed);
+                m_shrink_cooldown = kShrinkCooldown;
+                // Idle workers park waiting for work; move the surplus ones
+                // to the reserve instead
+                std::lock_guard<std::mutex> lock(m_park_mutex);
+                m_park_cv.notify_all();
+            }
+        }
+
+        inline auto Executor::CreateGroup(const ResourceGroupOptions &options)
+            -> ResourceGroup & {
+            std::unique_ptr<ResourceGroup> group(
+                new ResourceGroup(options, m_options.max_workers));
+            std::lock_guard<std::mutex> lock(m_groups_mutex);
+            m_groups.push_back(std::move(group));
+            return *m_groups.back();
+        }
+
+        inline void Executor::Schedule(ActorCell *actor) {
+            auto &group = actor->m_group;
+            group.m_actors.enqueue(actor);
+            AddWork(group);
+        }
+
+        inline auto Executor::Submit(ResourceGroup &group, Task task) -> bool {
+            if (!group.m_tasks.enqueue(std::move(task))) {
+                return false;
+            }
+            AddWork(group);
+            return true;
+        }
+
+        inline void Executor::AddWork(ResourceGroup &group) {
+            group.m_pending.fetch_add(1, std::memory_order_seq_cst);
+            IssueTokens(group);
+        }
+
+        // Pairs with the release in RunQuantum: of a producer bumping
+        // m_pending and a worker dropping a token, at least one sees the
+        // other's change, so queued work always has an idle token
+        inline void Executor::IssueTokens(ResourceGroup &group) {
+            auto tokens = group.m_tokens.load(std::memory_order_seq_cst);
+            while (tokens < group.m_tokens_limit &&
+                   static_cast<std::int64_t>(
+                       tokens - std::min(tokens, group.m_active.load(std::memory_order_seq_cst))) <
+                       group.m_pending.load(std::memory_order_seq_cst)) {
+                if (group.m_tokens.compare_exchange_weak(tokens, tokens + 1,
+                                                         std::memory_order_seq_cst)) {
+                    m_ring.enqueue(&group);
+                    WakeOne();
+                    tokens = group.m_tokens.load(std::memory_order_seq_cst);
+                }
+            }
+        }
+
+        inline void Executor::RunQuantum(ResourceGroup &group, WorkerSlot &slot,
+                                         Task &task) {
+            group.m_active.fetch_add(1, std::memory_order_seq_cst);
+            std::uint32_t turns = 0;
+            while (turns != group.m_weight) {
+                ActorCell *actor = nullptr;
+                bool got_actor = group.m_actors.try_dequeue(actor);
+                if (!got_actor && !group.m_tasks.try_dequeue(task)) {
+                    break;
+                }
+                group.m_pending.fetch_sub(1, std::memory_order_relaxed);
+                ++turns;
+                BeginTurn(slot);
+                if (got_actor) {
+                    Run(actor);
+                } else {
+                    task();
+                    task.Reset();
+                }
+                EndTurn(slot);
+            }
+            group.m_dispatched.fetch_add(turns, std::memory_order_relaxed);
+            auto active = group.m_active.fetch_sub(1, std::memory_order_seq_cst) - 1;
+            auto tokens = group.m_tokens.load(std::memory_order_seq_cst);
+            // Keep the token while there is work for it and every other
+            // idle token, at the back of the ring so that other groups get
+            // their turns first
+            if (group.m_pending.load(std::memory_order_seq_cst) >=
+                static_cast<std::int64_t>(tokens - std::min(tokens, active))) {
+                m_ring.enqueue(&group);
+                return;
+            }
+            group.m_tokens.fetch_sub(1, std::memory_order_seq_cst);
+            IssueTokens(group);
+        }
+
+        inline auto Executor::Queued() -> std::size_t {
+            std::lock_guard<std::mutex> lock(m_groups_mutex);
+            std::int64_t queued = 0;
+            for (auto &group : m_groups) {
+                queued += std::max<std::int64_t>(
+                    0, group->m_pending.load(std::memory_order_relaxed));
+            }
+            return static_cast<std::size_t>(queued);
+        }
+
+        inline void Executor::WakeOne() {
+            // Pairs with the fence in WorkerLoop: either the worker sees
+            // the new work before parking, or we see the worker parked
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_parked.load(std::memory_order_relaxed) != 0) {
+                std::lock_guard<std::mutex> lock(m_park_mutex);
+                m_park_cv.notify_one();
+            }
+        }
+
+        inline void Executor::Run(ActorCell *actor) {
+            actor->m_lifecycle.TryTransition(UnitState::kQueued, UnitState::kRunning);
+            auto handled = static_cast<std::int64_t>(
+                actor->RunBatch(m_options.batch));
+            // The actor must not be touched once this leaves nothing pending:
+            // the next Tell may already have it running elsewhere
+            bool requeue = false;
+            if (actor->m_lifecycle.Update([&](UnitLifecycle::Snapshot &s) {
+                    s.count -= handled;
+                    requeue = s.count > 0;
+                    s.state = requeue ? UnitState::kQueued : UnitState::kWaiting;
+                    return true;
+                }) &&
+                requeue) {
+                Schedule(actor);
+            }
+        }
+
+        inline void Executor::WorkerLoop(WorkerSlot &slot) {
+            Current() = {this, &slot};
+            moodycamel::ConsumerToken ring_token(m_ring);
+            Task task;
+            std::uint32_t idle = 0;
+            bool measure = m_options.scale_interval.count() != 0;
+            bool busy = false;
+            auto end_busy = [&] {
+                if (busy) {
+                    busy = false;
+                    auto since = slot.busy_since.load(std::memory_order_relaxed);
+                    slot.busy_ns.store(slot.busy_ns.load(std::memory_order_relaxed) +
+                                           NowNs() - since,
+                                       std::memory_order_relaxed);
+                    slot.busy_since.store(0, std::memory_order_relaxed);
+                }
+            };
+            while (true) {
+                if (Running() > Desired()) {
+                    end_busy();
+                    if (!Reserve()) {
+                        break;
+                    }
+                }
+                ResourceGroup *group = nullptr;
+                if (m_ring.try_dequeue(ring_token, group)) {
+                    idle = 0;
+                    if (measure && !busy) {
+                        busy = true;
+                        slot.busy_since.store(NowNs(), std::memory_order_relaxed);
+                    }
+                    RunQuantum(*group, slot, task);
+                    continue;
+                }
+                end_busy();
+                // Stopping drains the queues first. Every token left is held
+                // by a running worker, which puts it back and takes it again
+                // itself, and work submitted by a turn is in the ring before
+                // that worker looks again
+                if (m_stop.load(std::memory_order_acquire)) {
+                    break;
+                }
+                if (++idle < m_options.spin_count) {
+                    continue;
+                }
+                idle = 0;
+                std::unique_lock<std::mutex> lock(m_park_mutex);
+                m_parked.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (m_ring.size_approx() == 0 &&
+                    !m_stop.load(std::memory_order_relaxed) &&
+                    Running() <= Desired()) {
+                    m_park_cv.wait(lock);
+                }
+                m_parked.fetch_sub(1, std::memory_order_relaxed);
+            }
+            end_busy();
+            Current() = {};
+            slot.exited.store(true, std::memory_order_release);
+        }
+    } // namespace eng
+} // namespace ic
+
+namespace ic {
+    namespace eng {
+        /**
+         * A contract graph recorded once and flattened for repeated runs.
+         *
+         * Steps are `void(Context &)` callables tagged with the participant
+         * they stand for; the context carries one run's inputs and results.
+         * Recording resolves every dependency up front into CSR adjacency
+         * (the successors of all steps in one array, indexed by offsets),
+         * per-step in-degrees and stages -- a step's stage is the length of
+         * the longest dependency chain leading to it. The plan is immutable
+         * afterwards, so concurrent runs share it, and a run costs a copy
+         * of the in-degrees instead of rebuilding participant maps.
+         */
+        template <typename Context>
+        class ExecutionPlan : public std::enable_shared_from_this<ExecutionPlan<Context>> {
+        public:
+            using StepId = std::uint32_t;
+            using Step = std::function<void(Context &)>;
+
+            /// Contiguous run of step ids.
+            struct StepRange {
+                const StepId *first = nullptr;
+                const StepId *last = nullptr;
+
+                auto begin() const noexcept -> const StepId * { return first; }
+                auto end() const noexcept -> const StepId * { return last; }
+                auto size() const noexcept -> std::size_t {
+                    return static_cast<std::size_t>(last - first);
+                }
+            };
+
+            class Recorder;
+
+            ExecutionPlan(const ExecutionPlan &) = delete;
+            auto operator=(const ExecutionPlan &) -> ExecutionPlan & = delete;
+
+            auto StepCount() const noexcept -> std::size_t { return m_steps.size(); }
+            auto StageCount() const noexcept -> std::size_t {
+                return m_stage_offsets.size() - 1;
+            }
+
+            auto Role(StepId step) const noexcept -> ParticipantsType {
+                return m_roles[step];
+            }
+            auto Stage(StepId step) const noexcept -> std::uint32_t {
+                return m_stages[step];
+            }
+            auto InDegree(StepId step) const noexcept -> std::uint32_t {
+                return m_in_degrees[step];
+            }
+
+            /// Steps waiting for `step`.
+            auto Successors(StepId step) const noexcept -> StepRange {
+                return {m_successors.data() + m_successor_offsets[step],
+                        m_successors.data() + m_successor_offsets[step + 1]};
+            }
+
+            /// Steps of `stage`; they depend on earlier stages only.
+            auto StageSteps(std::uint32_t stage) const noexcept -> StepRange {
+                return {m_order.data() + m_stage_offsets[stage],
+                        m_order.data() + m_stage_offsets[stage + 1]};
+            }
+
+            /// Runs every step on the calling thread, stage by stage.
+            void Run(Context &context) const {
+                for (auto step : m_order) {
+                    m_steps[step](context);
+                }
+            }
+
+            /**
+             * Runs the plan on `executor`, each step as a task of `group`
+             * submitted once its dependencies have finished, and returns at
+             * once. `done` runs on the thread finishing the last step, at
+             * the latest while `executor` is destroyed, since it drains its
+             * queues first. `context` must stay alive until then; the run
+             * keeps the plan alive itself. Steps must not throw.
+             */
+            void Start(Executor &executor, Executor::ResourceGroup &group,
+                       Context &context, Executor::Task done = {}) const;
+            void Start(Executor &executor, Context &context,
+                       Executor::Task done = {}) const {
+                Start(executor, executor.DefaultGroup(), context, std::move(done));
+            }
+
+        private:
+            struct RunState {
+                std::shared_ptr<const ExecutionPlan> plan;
+                Context *context;
+                Executor *executor;
+                Executor::ResourceGroup *group;
+                Executor::Task done;
+                std::atomic<std::size_t> unfinished;
+                std::unique_ptr<std::atomic<std::uint32_t>[]> waiting_for;
+            };
+
+            ExecutionPlan() = default;
+
+            static void Dispatch(RunState *run, StepId step);
+            static void Execute(RunState *run, StepId step);
+
+            std::vector<Step> m_steps{};
+            std::vector<ParticipantsType> m_roles{};
+            // CSR: successors of step i are
+            // m_successors[m_successor_offsets[i] .. m_successor_offsets[i + 1])
+            std::vector<std::uint32_t> m_successor_offsets{};
+            std::vector<StepId> m_successors{};
+            std::vector<std::uint32_t> m_in_degrees{};
+            std::vector<std::uint32_t> m_stages{};
+            // Steps sorted by stage, a topological order, and where each
+            // stage starts in it
+            std::vector<StepId> m_order{};
+            std::vector<std::uint32_t> m_stage_offsets{};
+        };
+
+        /**
+         * Records the steps and dependencies of a graph, then flattens them
+         * into an ExecutionPlan.
+         */
+        template <typename Context> class ExecutionPlan<Context>::Recorder {
+        public:
+            auto AddStep(ParticipantsType role, Step step) -> StepId {
+                m_steps.push_back(std::move(step));
+                m_roles.push_back(role);
+                return static_cast<StepId>(m_steps.size() - 1);
+            }
+
+            /// `after` starts only once `before` has finished.
+            void AddDependency(StepId before, StepId after) {
+                m_edges.emplace_back(before, after);
+            }
+
+            /**
+             * Builds the plan and leaves the recorder empty. Returns nullptr
+             * if a dependency names an unknown step or the dependencies
+             * form a cycle.
+             */
+            auto Finish() -> std::shared_ptr<const ExecutionPlan>;
+
+        private:
+            std::vector<Step> m_steps{};
+            std::vector<ParticipantsType> m_roles{};
+            std::vector<std::pair<StepId, StepId>> m_edges{};
+        };
+
+        template <typename Context>
+        auto ExecutionPlan<Context>::Recorder::Finish()
+            -> std::shared_ptr<const ExecutionPlan> {
+            auto steps = std::move(m_steps);
+            auto roles = std::move(m_roles);
+            auto edges = std::move(m_edges);
+            m_steps.clear();
+            m_roles.clear();
+            m_edges.clear();
+
+            const auto count = steps.size();
+            std::shared_ptr<ExecutionPlan> plan(new ExecutionPlan());
+            plan->m_successor_offsets.assign(count + 1, 0);
+            plan->m_in_degrees.assign(count, 0);
+            for (const auto &[before, after] : edges) {
+                if (before >= count || after >= count) {
+                    return nullptr;
+                }
+                ++plan->m_successor_offsets[before + 1];
+                ++plan->m_in_degrees[after];
+            }
+            for (std::size_t i = 0; i != count; ++i) {
+                plan->m_successor_offsets[i + 1] += plan->m_successor_offsets[i];
+            }
+            plan->m_successors.resize(edges.size());
+            {
+                auto cursor = plan->m_successor_offsets;
+                for (const auto &[before, after] : edges) {
+                    plan->m_successors[cursor[before]++] = after;
+                }
+            }
+
+            // Kahn's algorithm; a step's stage is settled once its last
+            // dependency is taken
+            plan->m_stages.assign(count, 0);
+            std::vector<StepId> ready;
+            ready.reserve(count);
+            auto remaining = plan->m_in_degrees;
+            for (std::size_t i = 0; i != count; ++i) {
+                if (remaining[i] == 0) {
+                    ready.push_back(static_cast<StepId>(i));
+                }
+            }
+            std::uint32_t stages = count == 0 ? 0 : 1;
+            for (std::size_t taken = 0; taken != ready.size(); ++taken) {
+                auto step = ready[taken];
+                for (auto next : plan->Successors(step)) {
+                    auto &stage = plan->m_stages[next];
+                    stage = std::max(stage, plan->m_stages[step] + 1);
+                    stages = std::max(stages, stage + 1);
+                    if (--remaining[next] == 0) {
+                        ready.push_back(next);
+                    }
+                }
+            }
+            if (ready.size() != count) {
+                return nullptr;
+            }
+
+            // Counting sort by stage
+            plan->m_stage_offsets.assign(stages + 1, 0);
+            for (auto stage : plan->m_stages) {
+                ++plan->m_stage_offsets[stage + 1];
+            }
+            for (std::uint32_t i = 0; i != stages; ++i) {
+                plan->m_stage_offsets[i + 1] += plan->m_stage_offsets[i];
+            }
+            plan->m_order.resize(count);
+            {
+                auto cursor = plan->m_stage_offsets;
+                for (std::size_t i = 0; i != count; ++i) {
+                    plan->m_order[cursor[plan->m_stages[i]]++] = static_cast<StepId>(i);
+                }
+            }
+
+            plan->m_steps = std::move(steps);
+            plan->m_roles = std::move(roles);
+            return plan;
+        }
+
+        template <typename Context>
+        void ExecutionPlan<Context>::Start(Executor &executor,
+                                           Executor::ResourceGroup &group,
+                                           Context &context,
+                                           Executor::Task done) const {
+            if (m_steps.empty()) {
+                if (done) {
+                    done();
+                }
+                return;
+            }
+            auto run = new RunState{this->shared_from_this(), &context, &executor,
+                                    &group, std::move(done), {m_steps.size()},
+                                    std::make_unique<std::atomic<std::uint32_t>[]>(
+                                        m_steps.size())};
+            for (std::size_t i = 0; i != m_steps.size(); ++i) {
+                run->waiting_for[i].store(m_in_degrees[i], std::memory_order_relaxed);
+            }
+            // The run may finish, and be freed, as soon as the last root
+            // is dispatched, so the roots are read from the plan
+            for (auto step : StageSteps(0)) {
+                Dispatch(run, step);
+            }
+        }
+
+        template <typename Context>
+        void ExecutionPlan<Context>::Dispatch(RunState *run, StepId step) {
+            // Submit fails only if the queue cannot allocate; running the
+            // step here is slower but keeps the run going
+            if (!run->executor->Submit(*run->group, [run, step] { Execute(run, step); })) {
+                Execute(run, step);
+            }
+        }
+
+        template <typename Context>
+        void ExecutionPlan<Context>::Execute(RunState *run, StepId step) {
+            auto &plan = *run->plan;
+            const auto kNone = static_cast<StepId>(plan.m_steps.size());
+            while (true) {
+                plan.m_steps[step](*run->context);
+                // One successor made ready here runs next on this worker,
+                // skipping a trip through the queue; the rest are submitted
+                auto next = kNone;
+                for (auto successor : plan.Successors(step)) {
+                    if (run->waiting_for[successor].fetch_sub(
+                            1, std::memory_order_acq_rel) != 1) {
+                        continue;
+                    }
+                    if (next != kNone) {
+                        Dispatch(run, next);
+                    }
+                    next = successor;
+                }
+                // Once this step is counted out, another worker may finish
+                // the run and free it along with the plan, unless `next`
+                // (not finished yet) keeps them alive
+                if (run->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    auto done = std::move(run->done);
+                    delete run;
+                    if (done) {
+                        done();
+                    }
+                    return;
+                }
+                if (next == kNone) {
+                    return;
+                }
+                step = next;
+            }
+        }
+    } // namespace eng
+} // namespace ic
+
+namespace ic {
+    namespace eng {
+        /**
+         * Wire layout of a contract (see wire.hpp).
+         * Field IDs are append-only: never reuse or renumber them.
+         */
+        struct ContractFields {
+            enum : utils::wire::FieldId {
+                kId = 0,
+                kDate = 1,
+                kName = 2,
+                kDescription = 3
+            };
+        };
+
+        /**
+         * In-place view of an encoded contract; valid while the underlying
+         * buffer is.
+         */
+        class ContractView {
+        public:
+            ContractView() = default;
+
+            explicit ContractView(utils::wire::Table table) noexcept
+                : m_table(table) {}
+
+            auto IsNull() const noexcept -> bool { return m_table.IsNull(); }
+
+            auto Id() const noexcept -> std::string_view {
+                return m_table.GetString(ContractFields::kId);
+            }
+
+            auto Date() const noexcept -> std::string_view {
+                return m_table.GetString(ContractFields::kDate);
+            }
+
+            auto Name() const noexcept -> std::string_view {
+                return m_table.GetString(ContractFields::kName);
+            }
+
+            auto Description() const noexcept -> std::string_view {
+                return m_table.GetString(ContractFields::kDescription);
+            }
+
+            static auto Verify(const utils::wire::Verifier &verifier,
+                               utils::wire::Table table) noexcept -> bool {
+                return verifier.VerifyString(table, ContractFields::kId) &&
+                       verifier.VerifyString(table, ContractFields::kDate) &&
+                       verifier.VerifyString(table, ContractFields::kName) &&
+                       verifier.VerifyString(table,
+                                             ContractFields::kDescription);
+            }
+
+        private:
+            utils::wire::Table m_table{};
+        };
+
+        inline auto EncodeContract(utils::wire::Builder &builder,
+                                   std::string_view id, std::string_view date,
+                                   std::string_view name,
+                                   std::string_view description)
+            -> utils::wire::Offset {
+            auto id_offset = builder.CreateString(id);
+            auto date_offset = builder.CreateString(date);
+            auto name_offset = builder.CreateString(name);
+            auto description_offset = builder.CreateString(description);
+            builder.StartTable();
+            builder.AddOffset(ContractFields::kId, id_offset);
+            builder.AddOffset(ContractFields::kDate, date_offset);
+            builder.AddOffset(ContractFields::kName, name_offset);
+            builder.AddOffset(ContractFields::kDescription, description_offset);
+            return builder.EndTable();
+        }
+
+        /**
+         * Wire layout of a message passed between work units.
+         */
+        struct WorkUnitMessageFields {
+            enum : utils::wire::FieldId {
+                kSequence = 0,
+                kSender = 1,
+                kReceiver = 2,
+                kContract = 3,
+                kPayload = 4
+            };
+        };
+
+        class WorkUnitMessageView {
+        public:
+            WorkUnitMessageView() = default;
+
+            explicit WorkUnitMessageView(utils::wire::Table table) noexcept
+                : m_table(table) {}
+
+            /// Root message of a trusted buffer, e.g. one this process wrote
+            static auto FromBuffer(const void *buffer) noexcept
+                -> WorkUnitMessageView {
+                return WorkUnitMessageView(utils::wire::GetRoot(buffer));
+            }
+
+            /// Root message of an untrusted buffer; null if malformed
+            static auto FromUntrusted(const void *buffer,
+                                      std::size_t size) noexcept
+                -> WorkUnitMessageView {
+                utils::wire::Verifier verifier(buffer, size);
+                auto root = verifier.Root();
+                if (root.IsNull() || !Verify(verifier, root)) {
+                    return {};
+                }
+                return WorkUnitMessageView(root);
+            }
+
+            auto IsNull() const noexcept -> bool { return m_table.IsNull(); }
+
+            auto Sequence() const noexcept -> std::uint64_t {
+                return m_table.GetScalar<std::uint64_t>(
+                    WorkUnitMessageFields::kSequence);
+            }
+
+            auto Sender() const noexcept -> ParticipantsType {
+                return m_table.GetScalar<ParticipantsType>(
+                    WorkUnitMessageFields::kSender, ParticipantsType::kEmpty);
+            }
+
+            auto Receiver() const noexcept -> ParticipantsType {
+                return m_table.GetScalar<ParticipantsType>(
+                    WorkUnitMessageFields::kReceiver, ParticipantsType::kEmpty);
+            }
+
+            auto Contract() const noexcept -> ContractView {
+                return ContractView(
+                    m_table.GetTable(WorkUnitMessageFields::kContract));
+            }
+
+            auto Payload() const noexcept -> std::string_view {
+                return m_table.GetString(WorkUnitMessageFields::kPayload);
+            }
+
+            static auto Verify(const utils::wire::Verifier &verifier,
+                               utils::wire::Table table) noexcept -> bool {
+                using Fields = WorkUnitMessageFields;
+                if (!verifier.VerifyScalar<std::uint64_t>(table,
+                                                          Fields::kSequence) ||
+                    !verifier.VerifyScalar<ParticipantsType>(table,
+                                                             Fields::kSender) ||
+                    !verifier.VerifyScalar<ParticipantsType>(
+                        table, Fields::kReceiver) ||
+                    !verifier.VerifyString(table, Fields::kPayload) ||
+                    !verifier.VerifyTable(table, Fields::kContract)) {
+                    return false;
+                }
+                auto contract = table.GetTable(Fields::kContract);
+                return contract.IsNull() ||
+                       ContractView::Verify(verifier, contract);
+            }
+
+        private:
+            utils::wire::Table m_table{};
+        };
+
+        /**
+         * Encodes a complete message into `builder` and finishes it; the
+         * result is at builder.Data() / builder.Size().
+         */
+        inline void EncodeWorkUnitMessage(utils::wire::Builder &builder,
+                                          std::uint64_t sequence,
+                                          ParticipantsType sender,
+                                          ParticipantsType receiver,
+                                          utils::wire::Offset contract,
+                                          std::string_view payload) {
+            auto payload_offset =
+                builder.CreateBytes(payload.data(), payload.size());
+            builder.StartTable();
+            builder.AddScalar(WorkUnitMessageFields::kSequence, sequence);
+            builder.AddScalar(WorkUnitMessageFields::kSender, sender);
+            builder.AddScalar(WorkUnitMessageFields::kReceiver, receiver);
+            builder.AddOffset(WorkUnitMessageFields::kContract, contract);
+            builder.AddOffset(WorkUnitMessageFields::kPayload, payload_offset);
+            builder.Finish(builder.EndTable());
+        }
+    } // namespace eng
+} // namespace ic
+
+namespace IDApp {
+    enum class SchedulingPolicy {
+        kFifo = 0,
+        kFair = 1,
+        kLocality = 2
+    };
+
+    /**
+     * Runtime settings read on every operation and changed rarely.
+     *
+     * A published instance is immutable; see IDApplication::settings().
+     */
+    struct Settings {
+        std::size_t queue_capacity = 6 * 32;
+        std::uint32_t spin_count = 10000;
+        SchedulingPolicy scheduling_policy = SchedulingPolicy::kFifo;
+        /// Block size of queues made by IDApplication::makeQueue(); 0 is
+        /// replaced by a size calibrated on this host at startup
+        std::size_t queue_block_size = 0;
+    };
+} // namespace IDApp
+
 namespace IDApp {
 #define MY_EXIT_SUCCESS 0 /* Successful exit status.  */
     class IDApplication {
     public:
-        IDApplication(int argc, char *argv[]) {
+        IDApplication(int argc, char *argv[])
+            : m_settings(m_epoch_domain), m_control(m_epoch_domain) {
             // Constructor logic here
+            calibrateQueues();
+        }
+
+        /**
+         * Current settings snapshot: a single acquire load, no locks.
+         *
+         * The snapshot stays valid while the caller holds a
+         * utils::EpochDomain::Guard on epochDomain(), or, on the thread
+         * running exec(), until its next updateSettings() call.
+         */
+        auto settings() const noexcept -> const Settings & {
+            return *m_settings.Load();
+        }
+
+        /**
+         * Publishes a copy of the settings modified by `fn`.
+         * Must be called from the thread running exec().
+         *
+         * @param fn callable taking `Settings &`
+         */
+        template <typename Fn> void updateSettings(Fn &&fn) {
+            m_settings.Update(m_control, std::forward<Fn>(fn));
+        }
+
+        /**
+         * Creates a queue with the configured block size, see
+         * Settings::queue_block_size. Never calibrates: that is done once,
+         * at startup.
+         */
+        template <typename T>
+        auto makeQueue() -> std::unique_ptr<utils::IDynamicQueue<T>> {
+            const auto &current = settings();
+            auto block_size = current.queue_block_size;
+            if (block_size == 0) {
+                // Reset to 0 after startup: the ConcurrentQueue default
+                block_size = moodycamel::ConcurrentQueueDefaultTraits::BLOCK_SIZE;
+            }
+            return utils::MakeDynamicQueue<T>(block_size,
+                                              current.queue_capacity);
+        }
+
+        auto epochDomain() noexcept -> utils::EpochDomain & {
+            return m_epoch_domain;
+        }
+
+        /**
+         * Asynchronous logger for hot paths; use it through ID_LOG.
+         */
+        auto logger() noexcept -> utils::AsyncLogger & { return m_logger; }
+
+        /**
+         * Batched asynchronous file writes (journals, logs, dumps).
+         *
+         * Completions are delivered by processEvents() on the thread
+         * running exec(), never on the I/O threads.
+         */
+        auto io() noexcept -> utils::IoService & { return m_io; }
+
+        /**
+         * Sets the handler receiving I/O completions in processEvents().
+         *
+         * @param handler callable taking `const utils::IoCompletion &`
+         */
+        void setIoHandler(
+            std::function<void(const utils::IoCompletion &)> handler) {
+            m_io_handler = std::move(handler);
+        }
+
+        /**
+         * One step of the event loop: delivers pending I/O completions.
+         *
+         * @return the number of events processed
+         */
+        auto processEvents() -> std::size_t {
+            return m_io.PollCompletions([this](const auto &completion) {
+                if (m_io_handler) {
+                    m_io_handler(completion);
+                }
+            });
         }
 
         /**
@@ -580,9 +2514,29 @@ namespace IDApp {
 
         auto exec() -> int {
             // Execution logic here
+            processEvents();
 
             return MY_EXIT_SUCCESS;
         }
+
+    private:
+        /**
+         * Benchmarks the queue block sizes once, with word-sized elements
+         * (queues here carry pointers), and publishes the winner. Takes a
+         * few tens of milliseconds.
+         */
+        void calibrateQueues() {
+            auto block_size = utils::CalibrateBlockSize<void *>();
+            updateSettings(
+                [block_size](Settings &s) { s.queue_block_size = block_size; });
+        }
+
+        utils::AsyncLogger m_logger{};
+        utils::EpochDomain m_epoch_domain{};
+        utils::RcuCell<Settings> m_settings;
+        utils::EpochDomain::Participant m_control;
+        utils::IoService m_io{};
+        std::function<void(const utils::IoCompletion &)> m_io_handler{};
     };
 } // namespace IDApp
 
@@ -0,0 +1,99 @@
+// Intrusive multi-producer single-consumer queue (D. Vyukov's algorithm).
+//
+// Elements embed their own link by deriving from MpscNode, so pushing is a
+// single atomic exchange plus one store into the pushed node: no allocation,
+// no blocks to manage, and no cache line touched besides the node and the
+// queue head. The queue is empty when only the stub node is linked; the
+// stub is a bare MpscNode, so no element type is ever constructed for it.
+//
+// The queue does not own its nodes. A node must stay alive, and must not be
+// pushed again, until it has been popped.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+namespace utils {
+
+    struct MpscNode {
+        MpscNode() noexcept = default;
+        // A copy is a new, unlinked node
+        MpscNode(const MpscNode &) noexcept {}
+        auto operator=(const MpscNode &) noexcept -> MpscNode & {
+            return *this;
+        }
+
+        std::atomic<MpscNode *> mpsc_next{nullptr};
+    };
+
+    template <typename T> class IntrusiveMpscQueue final {
+    public:
+        IntrusiveMpscQueue() noexcept : head_(&stub_), tail_(&stub_) {}
+
+        IntrusiveMpscQueue(const IntrusiveMpscQueue &) = delete;
+        auto operator=(const IntrusiveMpscQueue &)
+            -> IntrusiveMpscQueue & = delete;
+
+        /// @brief Wait-free; callable from any thread.
+        void Push(T *node) noexcept { PushNode(Link(node)); }
+
+        /// @brief Returns the oldest node, or nullptr if the queue is empty
+        /// or a producer is halfway through Push (its node becomes
+        /// visible, with everything behind it, once that Push completes).
+        /// Consumer only.
+        auto TryPop() noexcept -> T * {
+            auto tail = tail_;
+            auto next = tail->mpsc_next.load(std::memory_order_acquire);
+            if (tail == &stub_) {
+                if (next == nullptr) {
+                    return nullptr;
+                }
+                tail_ = tail = next;
+                next = next->mpsc_next.load(std::memory_order_acquire);
+            }
+            if (next != nullptr) {
+                tail_ = next;
+                return static_cast<T *>(tail);
+            }
+            if (tail != head_.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            // `tail` is the last node: put the stub behind it so that it can
+            // be handed out without leaving the queue unlinked
+            PushNode(&stub_);
+            next = tail->mpsc_next.load(std::memory_order_acquire);
+            if (next != nullptr) {
+                tail_ = next;
+                return static_cast<T *>(tail);
+            }
+            return nullptr;
+        }
+
+        /// @brief Exact on the consumer thread when no Push is in progress.
+        auto Empty() const noexcept -> bool {
+            return tail_ == &stub_ &&
+                   stub_.mpsc_next.load(std::memory_order_acquire) == nullptr;
+        }
+
+    private:
+        static auto Link(T *node) noexcept -> MpscNode * {
+            static_assert(std::is_base_of_v<MpscNode, T>,
+                          "queued types must derive from MpscNode");
+            return node;
+        }
+
+        void PushNode(MpscNode *node) noexcept {
+            node->mpsc_next.store(nullptr, std::memory_order_relaxed);
+            auto prev = head_.exchange(node, std::memory_order_acq_rel);
+            prev->mpsc_next.store(node, std::memory_order_release);
+        }
+
+        // Producers and the consumer work on different cache lines
+        alignas(64) std::atomic<MpscNode *> head_;
+        alignas(64) MpscNode *tail_;
+        MpscNode stub_;
+    };
+
+} // namespace utils
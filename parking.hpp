@@ -0,0 +1,221 @@
+// Parking lot: a global, address-keyed table of waiting threads.
+//
+// Lock-like objects keep only a couple of state bits; a thread that has to
+// block parks itself in the bucket its object's address hashes to, and the
+// object's unlock path unparks it from there. Waiting state therefore costs
+// memory per blocked thread rather than per object, which lets millions of
+// mostly uncontended objects carry a lock in a single byte.
+//
+// CompactMutex is such a lock: one byte, one CAS to lock or unlock when
+// uncontended, a short spin, then parking. It is not fair -- a running
+// thread may barge ahead of a woken one -- which is what keeps the fast
+// path a single CAS.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+namespace utils {
+
+    class ParkingLot final {
+    public:
+        struct UnparkResult {
+            bool unparked = false;
+            /// Other threads may still be parked on the same address
+            bool may_have_more = false;
+        };
+
+        /// @brief Blocks the calling thread on `address` if validate(),
+        /// evaluated under the bucket lock, returns true. Returns whether
+        /// it parked (and was later unparked).
+        template <typename Validate>
+        static auto Park(const void *address, Validate &&validate) -> bool {
+            auto &self = Self();
+            auto &bucket = BucketFor(address);
+            {
+                std::lock_guard<std::mutex> lock(bucket.mutex);
+                if (!validate()) {
+                    return false;
+                }
+                self.address = address;
+                self.next = nullptr;
+                self.woken = false;
+                if (bucket.tail != nullptr) {
+                    bucket.tail->next = &self;
+                } else {
+                    bucket.head = &self;
+                }
+                bucket.tail = &self;
+            }
+            std::unique_lock<std::mutex> lock(self.mutex);
+            self.cv.wait(lock, [&] { return self.woken; });
+            return true;
+        }
+
+        /// @brief Wakes the oldest thread parked on `address`, if any.
+        /// callback(UnparkResult) runs under the bucket lock before the
+        /// thread is woken, so it can update the lock state atomically with
+        /// respect to Park's validation.
+        template <typename Callback>
+        static auto UnparkOne(const void *address, Callback &&callback)
+            -> UnparkResult {
+            auto &bucket = BucketFor(address);
+            UnparkResult result;
+            Waiter *waiter = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(bucket.mutex);
+                Waiter *prev = nullptr;
+                for (auto link = &bucket.head; *link != nullptr;
+                     prev = *link, link = &prev->next) {
+                    if ((*link)->address == address) {
+                        waiter = *link;
+                        *link = waiter->next;
+                        if (bucket.tail == waiter) {
+                            bucket.tail = prev;
+                        }
+                        break;
+                    }
+                }
+                if (waiter != nullptr) {
+                    for (auto it = waiter->next; it != nullptr; it = it->next) {
+                        if (it->address == address) {
+                            result.may_have_more = true;
+                            break;
+                        }
+                    }
+                }
+                result.unparked = waiter != nullptr;
+                callback(result);
+            }
+            if (waiter != nullptr) {
+                std::lock_guard<std::mutex> lock(waiter->mutex);
+                waiter->woken = true;
+                waiter->cv.notify_one();
+            }
+            return result;
+        }
+
+    private:
+        struct Waiter {
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool woken = false;
+            const void *address = nullptr;
+            Waiter *next = nullptr;
+        };
+
+        struct alignas(64) Bucket {
+            std::mutex mutex;
+            Waiter *head = nullptr;
+            Waiter *tail = nullptr;
+        };
+
+        static constexpr std::size_t kBuckets = 256;
+
+        static auto Self() -> Waiter & {
+            thread_local Waiter waiter;
+            return waiter;
+        }
+
+        static auto BucketFor(const void *address) -> Bucket & {
+            static std::array<Bucket, kBuckets> buckets;
+            auto key = reinterpret_cast<std::uintptr_t>(address);
+            key ^= key >> 17;
+            key *= 0x9E3779B97F4A7C15ULL;
+            return buckets[static_cast<std::size_t>(key >> 32) % kBuckets];
+        }
+    };
+
+    /// @brief One-byte mutex parking its waiters in the ParkingLot.
+    /// Satisfies Lockable, so it works with std::lock_guard and friends.
+    class CompactMutex final {
+    public:
+        CompactMutex() noexcept = default;
+        CompactMutex(const CompactMutex &) = delete;
+        auto operator=(const CompactMutex &) -> CompactMutex & = delete;
+
+        void lock() noexcept {
+            std::uint8_t expected = 0;
+            if (!state_.compare_exchange_weak(expected, kLocked,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+                LockSlow();
+            }
+        }
+
+        auto try_lock() noexcept -> bool {
+            auto state = state_.load(std::memory_order_relaxed);
+            while ((state & kLocked) == 0) {
+                if (state_.compare_exchange_weak(state, state | kLocked,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void unlock() noexcept {
+            std::uint8_t expected = kLocked;
+            if (!state_.compare_exchange_strong(expected, 0,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+                UnlockSlow();
+            }
+        }
+
+    private:
+        enum : std::uint8_t { kLocked = 1, kParked = 2 };
+
+        static constexpr int kSpins = 40;
+
+        void LockSlow() noexcept {
+            int spins = 0;
+            while (true) {
+                auto state = state_.load(std::memory_order_relaxed);
+                if ((state & kLocked) == 0) {
+                    if (state_.compare_exchange_weak(
+                            state, state | kLocked, std::memory_order_acquire,
+                            std::memory_order_relaxed)) {
+                        return;
+                    }
+                    continue;
+                }
+                // Nobody parked yet: the holder is probably about to unlock
+                if ((state & kParked) == 0 && spins < kSpins) {
+                    ++spins;
+                    std::this_thread::yield();
+                    continue;
+                }
+                if ((state & kParked) == 0 &&
+                    !state_.compare_exchange_weak(state, state | kParked,
+                                                  std::memory_order_relaxed,
+                                                  std::memory_order_relaxed)) {
+                    continue;
+                }
+                ParkingLot::Park(this, [this] {
+                    return state_.load(std::memory_order_relaxed) ==
+                           (kLocked | kParked);
+                });
+            }
+        }
+
+        void UnlockSlow() noexcept {
+            // Only the holder clears kLocked; the parked bit can only be set
+            // while it is held, so it is set here
+            ParkingLot::UnparkOne(this, [this](ParkingLot::UnparkResult r) {
+                state_.store(r.may_have_more ? kParked : 0,
+                             std::memory_order_release);
+            });
+        }
+
+        std::atomic<std::uint8_t> state_{0};
+    };
+
+} // namespace utils
@@ -0,0 +1,311 @@
+// Bounded-memory, lossless queue: a capped moodycamel::ConcurrentQueue that
+// overflows to local disk.
+//
+// The in-memory tier is a ConcurrentQueue whose blocks are all preallocated
+// and which is only ever written with try_enqueue(), so it never allocates
+// past its capacity. When it is full the queue switches to spill mode: new
+// items are staged into a block-sized buffer, and every full block is
+// appended to a segment file with one sequential write. Consumers drain the
+// memory tier first, then page blocks back in the order they were written,
+// and finally take whatever is still staged. Once the disk tier is empty
+// the queue switches back to the lock-free memory path.
+//
+// While spilling, producers keep writing to disk even if the memory tier
+// has room again -- that is what keeps each producer's items in FIFO order.
+//
+// Segment files are unlinked right after creation, so nothing is left
+// behind on a crash; the queue is a buffer, not a journal.
+
+#pragma once
+
+#include "conc.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace utils {
+
+    struct SpillOptions {
+        /// Directory for segment files; empty means $TMPDIR or /tmp
+        std::string directory{};
+        /// Blocks per segment file; a fully consumed segment is deleted
+        std::size_t segment_blocks = 4096;
+        /// Upper bound of the disk tier in bytes, 0 for unlimited
+        std::size_t max_disk_bytes = 0;
+    };
+
+    template <typename T,
+              typename Traits = moodycamel::ConcurrentQueueDefaultTraits>
+    class SpillQueue final {
+        static_assert(std::is_trivially_copyable_v<T>,
+                      "spilled items are written to disk byte by byte");
+
+    public:
+        /// @brief Items per spilled block, the same as the memory tier's.
+        static constexpr std::size_t kBlockItems = Traits::BLOCK_SIZE;
+
+        /// @param memory_capacity items kept in RAM before spilling; see
+        /// the ConcurrentQueue(size_t) constructor for how it translates
+        /// into preallocated blocks
+        explicit SpillQueue(std::size_t memory_capacity,
+                            SpillOptions options = {})
+            : memory_(memory_capacity), options_(std::move(options)) {
+            if (options_.segment_blocks == 0) {
+                options_.segment_blocks = 1;
+            }
+            staging_.reserve(kBlockItems);
+            read_.resize(kBlockItems);
+        }
+
+        SpillQueue(const SpillQueue &) = delete;
+        auto operator=(const SpillQueue &) -> SpillQueue & = delete;
+
+        ~SpillQueue() {
+            for (auto &segment : segments_) {
+                ::close(segment.fd);
+            }
+        }
+
+        /// @brief Never blocks on other producers while the memory tier has
+        /// room. Fails only if the item can be neither kept in memory nor
+        /// written to disk (I/O error or max_disk_bytes reached).
+        auto Enqueue(const T &item) -> bool {
+            if (!spilling_.load(std::memory_order_acquire) &&
+                memory_.try_enqueue(item)) {
+                return true;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Re-check under the lock: the consumers may have drained the
+            // disk tier in the meantime
+            if (!spilling_.load(std::memory_order_relaxed) &&
+                memory_.try_enqueue(item)) {
+                return true;
+            }
+            if (staging_.size() == kBlockItems && !WriteStaging()) {
+                return false;
+            }
+            spilling_.store(true, std::memory_order_release);
+            staging_.push_back(item);
+            spilled_items_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        auto TryDequeue(T &item) -> bool {
+            if (memory_.try_dequeue(item)) {
+                return true;
+            }
+            if (!spilling_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            return TryDequeueBulkSpilled(&item, 1) == 1;
+        }
+
+        template <typename It>
+        auto TryDequeueBulk(It item_first, std::size_t max) -> std::size_t {
+            auto count = memory_.try_dequeue_bulk(item_first, max);
+            if (count == max || !spilling_.load(std::memory_order_acquire)) {
+                return count;
+            }
+            std::advance(item_first, count);
+            return count + TryDequeueBulkSpilled(item_first, max - count);
+        }
+
+        /// @brief Approximate number of items in both tiers.
+        auto SizeApprox() const -> std::size_t {
+            return memory_.size_approx() +
+                   spilled_items_.load(std::memory_order_relaxed);
+        }
+
+        auto Spilling() const noexcept -> bool {
+            return spilling_.load(std::memory_order_relaxed);
+        }
+
+        /// @brief Bytes currently held in segment files.
+        auto DiskBytes() const noexcept -> std::size_t {
+            return disk_bytes_.load(std::memory_order_relaxed);
+        }
+
+        /// @brief errno of the last failed disk operation, 0 if none.
+        auto LastError() const noexcept -> int {
+            return last_error_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr std::size_t kBlockBytes = kBlockItems * sizeof(T);
+
+        struct Segment {
+            int fd;
+            std::size_t blocks_written;
+            std::size_t blocks_read;
+        };
+
+        template <typename It>
+        auto TryDequeueBulkSpilled(It item_first, std::size_t max)
+            -> std::size_t {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::size_t count = 0;
+            while (count != max) {
+                // Anything a producer put into memory before spilling
+                // started goes first
+                auto taken = memory_.try_dequeue_bulk(item_first, max - count);
+                if (taken != 0) {
+                    std::advance(item_first, taken);
+                    count += taken;
+                    continue;
+                }
+                if (read_pos_ == read_count_ && !ReadBlock()) {
+                    break;
+                }
+                std::size_t paged = 0;
+                while (count != max && read_pos_ != read_count_) {
+                    *item_first++ = read_[read_pos_++];
+                    ++count;
+                    ++paged;
+                }
+                spilled_items_.fetch_sub(paged, std::memory_order_relaxed);
+            }
+            return count;
+        }
+
+        // Refills read_ from the oldest segment, or from the staging buffer
+        // once the disk tier is empty. Called with mutex_ held.
+        auto ReadBlock() -> bool {
+            read_pos_ = read_count_ = 0;
+            while (!segments_.empty()) {
+                auto &segment = segments_.front();
+                if (segment.blocks_read == segment.blocks_written) {
+                    if (segments_.size() == 1) {
+                        break;
+                    }
+                    // Superseded and fully consumed
+                    ::close(segment.fd);
+                    segments_.pop_front();
+                    continue;
+                }
+                if (!Transfer(false, segment.fd, read_.data(),
+                              segment.blocks_read * kBlockBytes)) {
+                    return false;
+                }
+                ++segment.blocks_read;
+                disk_bytes_.fetch_sub(kBlockBytes, std::memory_order_relaxed);
+                read_count_ = kBlockItems;
+                return true;
+            }
+
+            if (!staging_.empty()) {
+                read_count_ = staging_.size();
+                std::copy(staging_.begin(), staging_.end(), read_.begin());
+                staging_.clear();
+                return true;
+            }
+
+            // Both tiers below memory are empty: reuse the last segment from
+            // its start and go back to the lock-free path
+            if (!segments_.empty()) {
+                auto &segment = segments_.front();
+                if (::ftruncate(segment.fd, 0) != 0) {
+                    last_error_.store(errno, std::memory_order_relaxed);
+                }
+                segment.blocks_written = segment.blocks_read = 0;
+            }
+            spilling_.store(false, std::memory_order_release);
+            return false;
+        }
+
+        // Appends the full staging buffer to the newest segment. Called with
+        // mutex_ held.
+        auto WriteStaging() -> bool {
+            if (options_.max_disk_bytes != 0 &&
+                disk_bytes_.load(std::memory_order_relaxed) + kBlockBytes >
+                    options_.max_disk_bytes) {
+                return false;
+            }
+            if (segments_.empty() ||
+                segments_.back().blocks_written == options_.segment_blocks) {
+                auto fd = CreateSegment();
+                if (fd < 0) {
+                    return false;
+                }
+                segments_.push_back(Segment{fd, 0, 0});
+            }
+            auto &segment = segments_.back();
+            if (!Transfer(true, segment.fd, staging_.data(),
+                          segment.blocks_written * kBlockBytes)) {
+                return false;
+            }
+            ++segment.blocks_written;
+            disk_bytes_.fetch_add(kBlockBytes, std::memory_order_relaxed);
+            staging_.clear();
+            return true;
+        }
+
+        auto CreateSegment() -> int {
+            auto directory = options_.directory;
+            if (directory.empty()) {
+                auto tmp = std::getenv("TMPDIR");
+                directory = tmp != nullptr && *tmp != '\0' ? tmp : "/tmp";
+            }
+            auto path = directory + "/idspill-XXXXXX";
+            auto fd = ::mkstemp(path.data());
+            if (fd < 0) {
+                last_error_.store(errno, std::memory_order_relaxed);
+                return -1;
+            }
+            ::unlink(path.c_str());
+            return fd;
+        }
+
+        auto Transfer(bool write, int fd, void *data, std::size_t offset)
+            -> bool {
+            auto bytes = static_cast<char *>(data);
+            std::size_t done = 0;
+            while (done != kBlockBytes) {
+                auto n = write ? ::pwrite(fd, bytes + done, kBlockBytes - done,
+                                          static_cast<off_t>(offset + done))
+                               : ::pread(fd, bytes + done, kBlockBytes - done,
+                                         static_cast<off_t>(offset + done));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    last_error_.store(n < 0 ? errno : EIO,
+                                      std::memory_order_relaxed);
+                    return false;
+                }
+                done += static_cast<std::size_t>(n);
+            }
+            return true;
+        }
+
+        moodycamel::ConcurrentQueue<T, Traits> memory_;
+        SpillOptions options_;
+        std::atomic<bool> spilling_{false};
+
+        // Disk tier, guarded by mutex_
+        std::mutex mutex_{};
+        std::vector<T> staging_{};
+        std::vector<T> read_{};
+        std::size_t read_pos_ = 0;
+        std::size_t read_count_ = 0;
+        std::deque<Segment> segments_{};
+
+        std::atomic<std::size_t> spilled_items_{0};
+        std::atomic<std::size_t> disk_bytes_{0};
+        std::atomic<int> last_error_{0};
+    };
+
+} // namespace utils
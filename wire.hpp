@@ -0,0 +1,465 @@
+// Offset-based binary layout for moving contracts and work unit messages
+// between stages, processes and disk.
+//
+// A buffer is read in place -- straight out of an mmap'd file, a shared
+// memory segment or a socket buffer -- without a parsing or copying step:
+// a view is a pointer into the buffer and every accessor is a couple of
+// loads. The layout follows the well-known "table + vtable" scheme:
+//
+//   header  | u32 magic | u32 size | u32 root |
+//   vtable  | u16 vtable bytes | u16 table bytes | u16 field offset[n] |
+//   table   | i32 table - vtable | fields, aligned to their size ...   |
+//   string  | u32 length | bytes | '\0' |
+//
+// Fields are addressed by a numeric ID that indexes the vtable. A field
+// missing from the vtable (offset 0, or an ID beyond its end) reads as its
+// default, which is what makes schemas versionable: a reader built against
+// a newer schema sees defaults for fields older writers never knew about,
+// and an older reader simply never looks at the IDs added after it. IDs are
+// therefore append-only; a retired field keeps its ID forever.
+//
+// Strings, bytes and nested tables are stored as i32 offsets relative to the
+// field that refers to them. All integers are little-endian.
+//
+// Buffers from untrusted sources must go through a Verifier before any
+// accessor is used; views themselves do no bounds checking.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "utils::wire assumes a little-endian host"
+#endif
+
+namespace utils {
+    namespace wire {
+
+        using FieldId = std::uint16_t;
+
+        inline constexpr std::uint32_t kMagic = 0x31574449; // "IDW1"
+        inline constexpr std::size_t kHeaderSize = 12;
+
+        namespace detail {
+            template <typename T>
+            inline auto Load(const char *p) noexcept -> T {
+                T value;
+                std::memcpy(&value, p, sizeof(T));
+                return value;
+            }
+
+            template <typename T>
+            inline void Store(char *p, T value) noexcept {
+                std::memcpy(p, &value, sizeof(T));
+            }
+        } // namespace detail
+
+        /// @brief Position of an object written by the Builder.
+        struct Offset {
+            std::uint32_t pos = 0;
+
+            auto IsNull() const noexcept -> bool { return pos == 0; }
+        };
+
+        /// @brief Read-only view of a table inside a buffer.
+        class Table {
+        public:
+            Table() = default;
+
+            explicit Table(const char *table) noexcept : table_(table) {}
+
+            auto IsNull() const noexcept -> bool { return table_ == nullptr; }
+
+            auto Has(FieldId id) const noexcept -> bool {
+                return FieldOffset(id) != 0;
+            }
+
+            template <typename T>
+            auto GetScalar(FieldId id, T default_value = T{}) const noexcept
+                -> T {
+                static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+                auto offset = FieldOffset(id);
+                return offset == 0 ? default_value
+                                   : detail::Load<T>(table_ + offset);
+            }
+
+            /// @brief Zero-copy view of a string field; empty when absent.
+            auto GetString(FieldId id) const noexcept -> std::string_view {
+                auto target = Follow(id);
+                if (target == nullptr) {
+                    return {};
+                }
+                return {target + 4, detail::Load<std::uint32_t>(target)};
+            }
+
+            auto GetTable(FieldId id) const noexcept -> Table {
+                return Table(Follow(id));
+            }
+
+            auto Data() const noexcept -> const char * { return table_; }
+
+        private:
+            friend class Verifier;
+
+            auto VTable() const noexcept -> const char * {
+                return table_ - detail::Load<std::int32_t>(table_);
+            }
+
+            auto FieldOffset(FieldId id) const noexcept -> std::uint16_t {
+                if (table_ == nullptr) {
+                    return 0;
+                }
+                auto vtable = VTable();
+                auto entry = 4U + 2U * id;
+                if (entry >= detail::Load<std::uint16_t>(vtable)) {
+                    return 0;
+                }
+                return detail::Load<std::uint16_t>(vtable + entry);
+            }
+
+            auto Follow(FieldId id) const noexcept -> const char * {
+                auto offset = FieldOffset(id);
+                if (offset == 0) {
+                    return nullptr;
+                }
+                auto field = table_ + offset;
+                return field + detail::Load<std::int32_t>(field);
+            }
+
+            const char *table_ = nullptr;
+        };
+
+        /// @brief Root table of a finished buffer; no validation, see Verifier.
+        inline auto GetRoot(const void *buffer) noexcept -> Table {
+            auto base = static_cast<const char *>(buffer);
+            return Table(base + detail::Load<std::uint32_t>(base + 8));
+        }
+
+        /// @brief Bounds checks of a buffer of unknown origin.
+        ///
+        /// Schema views drive it field by field, see e.g.
+        /// ic::eng::ContractView::Verify().
+        class Verifier {
+        public:
+            Verifier(const void *buffer, std::size_t size) noexcept
+                : base_(static_cast<const char *>(buffer)), size_(size) {}
+
+            /// @brief Checks the header and returns the root table, or a
+            /// null table when the buffer is malformed.
+            auto Root() const noexcept -> Table {
+                if (size_ < kHeaderSize ||
+                    detail::Load<std::uint32_t>(base_) != kMagic ||
+                    detail::Load<std::uint32_t>(base_ + 4) > size_) {
+                    return {};
+                }
+                auto root = detail::Load<std::uint32_t>(base_ + 8);
+                if (root >= size_ || !VerifyTableAt(base_ + root)) {
+                    return {};
+                }
+                return GetRoot(base_);
+            }
+
+            /// @brief A present scalar field must fit into its table.
+            template <typename T>
+            auto VerifyScalar(const Table &table, FieldId id) const noexcept
+                -> bool {
+                auto offset = table.FieldOffset(id);
+                return offset == 0 ||
+                       offset + sizeof(T) <= TableSize(table);
+            }
+
+            auto VerifyString(const Table &table, FieldId id) const noexcept
+                -> bool {
+                const char *target;
+                if (!VerifyReference(table, id, target)) {
+                    return false;
+                }
+                if (target == nullptr) {
+                    return true;
+                }
+                if (!InBounds(target, 4)) {
+                    return false;
+                }
+                auto length = detail::Load<std::uint32_t>(target);
+                return InBounds(target + 4, std::size_t(length) + 1) &&
+                       target[4 + length] == '\0';
+            }
+
+            auto VerifyTable(const Table &table, FieldId id) const noexcept
+                -> bool {
+                const char *target;
+                if (!VerifyReference(table, id, target)) {
+                    return false;
+                }
+                return target == nullptr || VerifyTableAt(target);
+            }
+
+        private:
+            auto InBounds(const char *p, std::size_t length) const noexcept
+                -> bool {
+                return p >= base_ + kHeaderSize && p <= base_ + size_ &&
+                       length <= std::size_t(base_ + size_ - p);
+            }
+
+            static auto TableSize(const Table &table) noexcept
+                -> std::uint16_t {
+                return detail::Load<std::uint16_t>(table.VTable() + 2);
+            }
+
+            auto VerifyTableAt(const char *table) const noexcept -> bool {
+                if (!InBounds(table, 4) ||
+                    (reinterpret_cast<std::uintptr_t>(table) -
+                     reinterpret_cast<std::uintptr_t>(base_)) % 4 != 0) {
+                    return false;
+                }
+                auto vtable = table - detail::Load<std::int32_t>(table);
+                if (!InBounds(vtable, 4)) {
+                    return false;
+                }
+                auto vtable_size = detail::Load<std::uint16_t>(vtable);
+                auto table_size = detail::Load<std::uint16_t>(vtable + 2);
+                if (vtable_size < 4 || vtable_size % 2 != 0 ||
+                    !InBounds(vtable, vtable_size) ||
+                    !InBounds(table, table_size)) {
+                    return false;
+                }
+                for (std::uint16_t entry = 4; entry < vtable_size; entry += 2) {
+                    auto offset = detail::Load<std::uint16_t>(vtable + entry);
+                    if (offset != 0 && (offset < 4 || offset >= table_size)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            auto VerifyReference(const Table &table, FieldId id,
+                                 const char *&target) const noexcept -> bool {
+                target = nullptr;
+                auto offset = table.FieldOffset(id);
+                if (offset == 0) {
+                    return true;
+                }
+                if (offset + 4U > TableSize(table)) {
+                    return false;
+                }
+                auto field = table.Data() + offset;
+                auto relative = detail::Load<std::int32_t>(field);
+                auto distance = field - base_;
+                if (relative < -distance ||
+                    relative > static_cast<std::ptrdiff_t>(size_) - distance) {
+                    return false;
+                }
+                target = field + relative;
+                return true;
+            }
+
+            const char *base_;
+            std::size_t size_;
+        };
+
+        /// @brief Writes one buffer front to back.
+        ///
+        /// Strings and nested tables are created first, then the table that
+        /// refers to them; only one table can be under construction at a
+        /// time. A builder is reusable after Reset() and keeps its capacity,
+        /// so steady-state encoding does not allocate.
+        ///
+        /// ## Example usage:
+        /// @code
+        /// utils::wire::Builder builder;
+        /// auto name = builder.CreateString("supply");
+        /// builder.StartTable();
+        /// builder.AddOffset(kName, name);
+        /// builder.AddScalar<std::uint64_t>(kSequence, 42);
+        /// builder.Finish(builder.EndTable());
+        /// Send(builder.Data(), builder.Size());
+        /// @endcode
+        class Builder {
+        public:
+            explicit Builder(std::size_t initial_capacity = 1024) {
+                buffer_.reserve(initial_capacity);
+                Reset();
+            }
+
+            void Reset() {
+                buffer_.assign(kHeaderSize, '\0');
+                fields_.clear();
+                vtables_.clear();
+                finished_ = false;
+            }
+
+            auto CreateString(std::string_view value) -> Offset {
+                return CreateBytes(value.data(), value.size());
+            }
+
+            /// @brief Raw bytes, read back through Table::GetString().
+            auto CreateBytes(const void *data, std::size_t size) -> Offset {
+                Align(4);
+                Offset offset{static_cast<std::uint32_t>(buffer_.size())};
+                auto length = static_cast<std::uint32_t>(size);
+                auto at = Grow(4 + size + 1);
+                detail::Store(at, length);
+                if (size != 0) {
+                    std::memcpy(at + 4, data, size);
+                }
+                at[4 + size] = '\0';
+                return offset;
+            }
+
+            void StartTable() { fields_.clear(); }
+
+            template <typename T>
+            void AddScalar(FieldId id, T value) {
+                static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+                static_assert(sizeof(T) <= 8);
+                Field field{id, sizeof(T), false, {}};
+                std::memcpy(field.bytes, &value, sizeof(T));
+                fields_.push_back(field);
+            }
+
+            /// @brief Refers to a string, bytes or a finished nested table.
+            void AddOffset(FieldId id, Offset target) {
+                if (target.IsNull()) {
+                    return;
+                }
+                Field field{id, 4, true, {}};
+                std::memcpy(field.bytes, &target.pos, 4);
+                fields_.push_back(field);
+            }
+
+            auto EndTable() -> Offset {
+                // Widest fields first, so that no padding is needed inside;
+                // tables are small, and unlike std::stable_sort insertion
+                // sort does not allocate
+                for (std::size_t i = 1; i < fields_.size(); ++i) {
+                    auto field = fields_[i];
+                    auto j = i;
+                    for (; j != 0 && fields_[j - 1].size < field.size; --j) {
+                        fields_[j] = fields_[j - 1];
+                    }
+                    fields_[j] = field;
+                }
+                FieldId max_id = 0;
+                for (auto &field : fields_) {
+                    max_id = std::max(max_id, field.id);
+                }
+                std::uint16_t field_count =
+                    fields_.empty() ? 0 : static_cast<std::uint16_t>(max_id + 1);
+
+                // The vtable is computed up front to be shared with an
+                // identical one written before
+                std::uint16_t table_size = 4;
+                scratch_.assign(2 + field_count, 0);
+                for (auto &field : fields_) {
+                    if (table_size % field.size != 0) {
+                        table_size += field.size - table_size % field.size;
+                    }
+                    scratch_[2 + field.id] = table_size;
+                    table_size += field.size;
+                }
+                scratch_[0] = static_cast<std::uint16_t>(4 + 2 * field_count);
+                scratch_[1] = table_size;
+                auto vtable = FindOrWriteVTable();
+
+                // Tables are 8-aligned relative to the buffer start, which
+                // keeps 8-byte fields aligned in a page-aligned mapping
+                Align(8);
+                auto table = static_cast<std::uint32_t>(buffer_.size());
+                auto at = Grow(table_size);
+                std::memset(at, 0, table_size);
+                detail::Store(at, static_cast<std::int32_t>(table - vtable));
+                for (auto &field : fields_) {
+                    auto offset = scratch_[2 + field.id];
+                    auto dst = buffer_.data() + table + offset;
+                    if (field.is_offset) {
+                        std::uint32_t target;
+                        std::memcpy(&target, field.bytes, 4);
+                        detail::Store(dst, static_cast<std::int32_t>(
+                                               std::int64_t(target) -
+                                               std::int64_t(table + offset)));
+                    } else {
+                        std::memcpy(dst, field.bytes, field.size);
+                    }
+                }
+                fields_.clear();
+                return Offset{table};
+            }
+
+            void Finish(Offset root) {
+                auto base = buffer_.data();
+                detail::Store(base, kMagic);
+                detail::Store(base + 4, static_cast<std::uint32_t>(
+                                            buffer_.size()));
+                detail::Store(base + 8, root.pos);
+                finished_ = true;
+            }
+
+            auto Data() const noexcept -> const char * {
+                return buffer_.data();
+            }
+
+            auto Size() const noexcept -> std::size_t { return buffer_.size(); }
+
+            auto Finished() const noexcept -> bool { return finished_; }
+
+            /// @brief Hands the finished buffer over; the builder is reset.
+            auto Release() -> std::vector<char> {
+                auto result = std::move(buffer_);
+                buffer_ = {};
+                Reset();
+                return result;
+            }
+
+        private:
+            struct Field {
+                FieldId id;
+                std::uint16_t size;
+                bool is_offset;
+                char bytes[8];
+            };
+
+            auto Grow(std::size_t size) -> char * {
+                auto at = buffer_.size();
+                buffer_.resize(at + size);
+                return buffer_.data() + at;
+            }
+
+            void Align(std::size_t alignment) {
+                auto padding = (alignment - buffer_.size() % alignment) %
+                               alignment;
+                buffer_.resize(buffer_.size() + padding, '\0');
+            }
+
+            auto FindOrWriteVTable() -> std::uint32_t {
+                auto bytes = scratch_.size() * 2;
+                for (auto vtable : vtables_) {
+                    if (detail::Load<std::uint16_t>(buffer_.data() + vtable) ==
+                            bytes &&
+                        std::memcmp(buffer_.data() + vtable, scratch_.data(),
+                                    bytes) == 0) {
+                        return vtable;
+                    }
+                }
+                Align(4);
+                auto vtable = static_cast<std::uint32_t>(buffer_.size());
+                std::memcpy(Grow(bytes), scratch_.data(), bytes);
+                vtables_.push_back(vtable);
+                return vtable;
+            }
+
+            std::vector<char> buffer_{};
+            std::vector<Field> fields_{};
+            std::vector<std::uint16_t> scratch_{};
+            std::vector<std::uint32_t> vtables_{};
+            bool finished_ = false;
+        };
+
+    } // namespace wire
+} // namespace utils